@@ -5,46 +5,68 @@ lf = re.compile(r'\n+')
 
 ARR_TYPE = 'vec'
 header = 'template<typename T, int N> constexpr $ARR<$OUT, N> '
+
+# Fast path taken outside of constant evaluation when vec<T, N> fits a native
+# vector type, see `_vec_native` in prelude.hpp
+native_path = '''
+  if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::$STORE($NATIVE); } }
+'''
+
 bin_templ = header+'''
-operator$OP($ARR<T,N> a, $ARR<T,N> b){
+operator$OP($ARR<T,N> a, $ARR<T,N> b){'''+native_path+'''
   $ARR<$OUT, N> r{};
   for(int i=0;i<N;i++) r[i] = a[i] $OP b[i];
   return r;
 }
 '''
 bin_scalar_templ_a = header+'''
-operator$OP($ARR<T,N> a, T s){
+operator$OP($ARR<T,N> a, T s){'''+native_path+'''
   $ARR<$OUT, N> r{};
   for(int i=0;i<N;i++) r[i] = a[i] $OP s;
   return r;
 }
 '''
 bin_scalar_templ_b = header+'''
-operator$OP(T s, $ARR<T,N> a){
+operator$OP(T s, $ARR<T,N> a){'''+native_path+'''
   $ARR<$OUT, N> r{};
   for(int i=0;i<N;i++) r[i] = s $OP a[i];
   return r;
 }
 '''
 unary_templ = header+'''
-operator$OP($ARR<T,N> a){
+operator$OP($ARR<T,N> a){'''+native_path+'''
   $ARR<$OUT, N> r{};
   for(int i=0;i<N;i++) r[i] = $OP a[i];
   return r;
 }
 '''
 
+NA = '_vec_native::load(a)'
+NB = '_vec_native::load(b)'
+
+# Vector extensions have no logical operators, express them through masks
+native_logic = {
+    '&&': f'({NA} != 0) & ({NB} != 0)',
+    '||': f'({NA} != 0) | ({NB} != 0)',
+    '!':  f'{NA} == 0',
+}
+
 def arith_bin(op):
-    return '\n'.join([bin_templ, bin_scalar_templ_a, bin_scalar_templ_b]).replace('$OP', op).replace('$OUT', 'T')
+    bin_expr = bin_templ.replace('$NATIVE', f'{NA} $OP {NB}')
+    scalar_a = bin_scalar_templ_a.replace('$NATIVE', f'{NA} $OP s')
+    scalar_b = bin_scalar_templ_b.replace('$NATIVE', f's $OP {NA}')
+    return '\n'.join([bin_expr, scalar_a, scalar_b]).replace('$STORE', 'store<T, N>').replace('$OP', op).replace('$OUT', 'T')
 
 def arith_unary(op):
-    return unary_templ.replace('$OP', op).replace('$OUT', 'T')
+    return unary_templ.replace('$NATIVE', f'$OP {NA}').replace('$STORE', 'store<T, N>').replace('$OP', op).replace('$OUT', 'T')
 
 def logic_bin(op):
-    return bin_templ.replace('$OP', op).replace('$OUT', 'bool')
+    expr = native_logic.get(op, f'{NA} $OP {NB}')
+    return bin_templ.replace('$NATIVE', expr).replace('$STORE', 'store_mask<N>').replace('$OP', op).replace('$OUT', 'bool')
 
 def logic_unary(op):
-    return unary_templ.replace('$OP', op).replace('$OUT', 'bool')
+    expr = native_logic.get(op, f'$OP {NA}')
+    return unary_templ.replace('$NATIVE', expr).replace('$STORE', 'store_mask<N>').replace('$OP', op).replace('$OUT', 'bool')
 
 operators = {
     '+': [arith_bin, arith_unary],
@@ -80,5 +102,5 @@ struct $ARR {
 ''')
 
 decls = lf.sub('\n', '\n'.join(decls).replace('$ARR', ARR_TYPE))
-decls = '\n'.join(filter(lambda x: len(x.strip()) > 0, decls.replace('template', '\ntemplate').split('\n')))
+decls = '\n'.join(x.rstrip() for x in decls.replace('template', '\ntemplate').split('\n') if len(x.strip()) > 0)
 print(decls)
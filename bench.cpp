@@ -0,0 +1,798 @@
+/* Microbenchmark harness and the prelude's benchmark suites. Build and run
+ * with `./build.sh bench`. Each benchmark is a function that runs its body
+ * `n` times, the harness picks `n` so a sample takes at least
+ * `sample_target`, warms up, then reports per-operation min/median/p99 and
+ * throughput over `sample_count` samples. */
+#include "prelude.hpp"
+#include "io.cpp"
+
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+
+namespace bench {
+constexpr inline isize sample_count = 51;
+constexpr inline i64 sample_target_ns = 2'000'000;
+constexpr inline i64 warmup_ns = 20'000'000;
+
+// Force `value` to be materialized, so the computation producing it can't be
+// removed by the optimizer
+template<typename T>
+static inline void do_not_optimize(T const& value){
+#if defined(__clang__) || defined(__GNUC__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile T const* sink;
+	sink = &value;
+#endif
+}
+
+// Compiler barrier, memory written before it must be considered observed
+static inline void clobber(){
+#if defined(__clang__) || defined(__GNUC__)
+	asm volatile("" : : : "memory");
+#else
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+struct Config {
+	isize bytes_per_op = 0;
+	isize items_per_op = 1;
+};
+
+struct Report {
+	cstring name;
+	isize iterations; /* Per sample */
+	f64 min_ns;
+	f64 median_ns;
+	f64 p99_ns;
+	f64 bytes_per_sec;
+	f64 items_per_sec;
+};
+
+template<typename F>
+static inline i64 _time_batch(F& f, isize n){
+	temporal::Stopwatch watch;
+	watch.reset();
+	f(n);
+	clobber();
+	return watch.measure().count_nanoseconds();
+}
+
+static inline void print_header(cstring suite){
+	printf("\n== %s ==\n", suite);
+	printf("%-40s %12s %12s %12s %12s %14s\n", "benchmark", "min ns/op", "median", "p99", "MB/s", "items/s");
+}
+
+static inline void print_report(Report const& r){
+	char mbps[32] = "-";
+	if(r.bytes_per_sec > 0){
+		snprintf(mbps, sizeof(mbps), "%.1f", r.bytes_per_sec / 1e6);
+	}
+	printf("%-40s %12.2f %12.2f %12.2f %12s %14.4g\n", r.name, r.min_ns, r.median_ns, r.p99_ns, mbps, r.items_per_sec);
+}
+
+// Run benchmark `f(isize n)`, which must perform `n` operations
+template<typename F>
+static inline Report run(cstring name, F f, Config cfg = {}){
+	/* Calibrate */
+	isize n = 1;
+	for(;;){
+		i64 t = _time_batch(f, n);
+		if(t >= sample_target_ns || n >= (isize(1) << 40)){ break; }
+		isize scale = t > 0 ? (sample_target_ns / t) + 1 : 16;
+		n *= clamp(isize(2), scale, isize(16));
+	}
+
+	/* Warmup */
+	for(i64 elapsed = 0; elapsed < warmup_ns;){
+		elapsed += _time_batch(f, n);
+	}
+
+	/* Measure */
+	f64 samples[sample_count];
+	for(isize i = 0; i < sample_count; i++){
+		samples[i] = f64(_time_batch(f, n)) / f64(n);
+	}
+	for(isize i = 1; i < sample_count; i++){
+		for(isize j = i; j > 0 && samples[j - 1] > samples[j]; j--){
+			f64 tmp = samples[j];
+			samples[j] = samples[j - 1];
+			samples[j - 1] = tmp;
+		}
+	}
+
+	Report r;
+	r.name = name;
+	r.iterations = n;
+	r.min_ns = samples[0];
+	r.median_ns = samples[sample_count / 2];
+	r.p99_ns = samples[(sample_count * 99) / 100];
+	r.bytes_per_sec = f64(cfg.bytes_per_op) * 1e9 / r.median_ns;
+	r.items_per_sec = f64(cfg.items_per_op) * 1e9 / r.median_ns;
+	print_report(r);
+	return r;
+}
+}
+
+/* ---------------- Suites ---------------- */
+static void bench_temporal(){
+	bench::print_header("temporal");
+
+	bench::run("high_res_now", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(temporal::high_res_now());
+		}
+	});
+
+	bench::run("Cycle_Counter::now", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(temporal::Cycle_Counter::now());
+		}
+	});
+
+	bench::run("Cycle_Counter::now_serialized", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(temporal::Cycle_Counter::now_serialized());
+		}
+	});
+
+	bench::run("Cycle_Stopwatch reset + measure", [&](isize n){
+		temporal::Cycle_Stopwatch watch;
+		for(isize i = 0; i < n; i++){
+			watch.reset();
+			bench::do_not_optimize(watch.measure());
+		}
+	});
+}
+
+static void bench_arena(){
+	bench::print_header("Arena");
+	auto buf = mem::heap_allocator().make_slice<byte>(4 * mem::MiB);
+	auto arena = mem::Arena::from_bytes(buf);
+	auto allocator = arena.allocator();
+
+	bench::run("arena.alloc(32, 8)", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			if(arena.offset > arena.cap - 64){ arena.reset(); }
+			bench::do_not_optimize(arena.alloc(32, 8));
+		}
+	});
+
+	bench::run("allocator.alloc(32, 8) via arena", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			if(arena.offset > arena.cap - 64){ arena.reset(); }
+			bench::do_not_optimize(allocator.alloc(32, 8));
+		}
+	});
+
+	bench::run("allocator.try_alloc(32, 8) via arena", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			if(arena.offset > arena.cap - 64){ arena.reset(); }
+			bench::do_not_optimize(allocator.try_alloc(32, 8).unwrap_unchecked());
+		}
+	});
+
+	mem::heap_allocator().destroy(buf);
+}
+
+static void bench_dynamic_array(){
+	bench::print_header("Dynamic_Array");
+	auto buf = mem::heap_allocator().make_slice<byte>(16 * mem::MiB);
+	auto arena = mem::Arena::from_bytes(buf);
+	constexpr isize count = 1000;
+
+	bench::run("append x1000 (arena, growing)", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			arena.reset();
+			auto arr = Dynamic_Array<i32>::from(arena.allocator());
+			for(isize k = 0; k < count; k++){ (void)arr.append(k); }
+			bench::do_not_optimize(arr.data);
+		}
+	}, {.bytes_per_op = count * isize(sizeof(i32)), .items_per_op = count});
+
+	bench::run("append x1000 (heap, growing)", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			auto arr = Dynamic_Array<i32>::from(mem::heap_allocator());
+			for(isize k = 0; k < count; k++){ (void)arr.append(k); }
+			bench::do_not_optimize(arr.data);
+			arr.destroy();
+		}
+	}, {.bytes_per_op = count * isize(sizeof(i32)), .items_per_op = count});
+
+	mem::heap_allocator().destroy(buf);
+}
+
+static void bench_string(){
+	bench::print_header("string");
+	string padded = " \t\n   some text in the middle of whitespace  \r\n\t ";
+	string text = "The quick brown fox jumps over the lazy dog. Ünïcödé text, 日本語のテキスト.";
+
+	bench::run("trim_whitespace", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(padded);
+			bench::do_not_optimize(padded.trim_whitespace());
+		}
+	}, {.bytes_per_op = padded.len()});
+
+	bench::run("rune_count", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(text);
+			bench::do_not_optimize(text.rune_count());
+		}
+	}, {.bytes_per_op = text.len()});
+
+	bench::run("operator==", [&](isize n){
+		string other = text.sub(0, text.len());
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(other);
+			bench::do_not_optimize(text == other);
+		}
+	}, {.bytes_per_op = text.len()});
+}
+
+static void bench_utf8(){
+	bench::print_header("utf8");
+	auto heap = mem::heap_allocator();
+	constexpr isize size = 1 * mem::MiB;
+	auto ascii = heap.make_slice<byte>(size);
+	auto mixed = heap.make_slice<byte>(size);
+	auto runes = heap.make_slice<rune>(size);
+	auto units = heap.make_slice<u16>(size);
+	auto bytes = heap.make_slice<byte>(size);
+
+	string sample = "Plain ascii words, then some ünïcödé and 日本語 ";
+	for(isize i = 0; i < size; i++){
+		ascii[i] = 'a' + (i % 26);
+	}
+	isize mixed_len = 0;
+	while(mixed_len + sample.len() <= size){
+		mem::copy_no_overlap(&mixed[mixed_len], sample.raw_data(), sample.len());
+		mixed_len += sample.len();
+	}
+	string ascii_str = string::from_bytes(ascii.raw_data(), size);
+	string mixed_str = string::from_bytes(mixed.raw_data(), mixed_len);
+
+	bench::run("per-rune Iterator, ascii 1MiB", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			rune acc = 0;
+			for(auto it = ascii_str.iterator(); !it.done();){ acc += it.next().codepoint; }
+			bench::do_not_optimize(acc);
+		}
+	}, {.bytes_per_op = size});
+
+	bench::run("decode_into, ascii 1MiB", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(utf8::decode_into(runes, ascii_str));
+		}
+	}, {.bytes_per_op = size});
+
+	bench::run("decode_into, mixed 1MiB", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(utf8::decode_into(runes, mixed_str));
+		}
+	}, {.bytes_per_op = mixed_len});
+
+	auto decoded = utf8::decode_into(runes, mixed_str);
+	bench::run("encode_from, mixed 1MiB", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(utf8::encode_from(bytes, runes.sub(0, decoded.written)));
+		}
+	}, {.bytes_per_op = mixed_len});
+
+	bench::run("to_utf16, mixed 1MiB", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			bench::do_not_optimize(utf8::to_utf16(units, mixed_str));
+		}
+	}, {.bytes_per_op = mixed_len});
+
+	heap.destroy(ascii);
+	heap.destroy(mixed);
+	heap.destroy(runes);
+	heap.destroy(units);
+	heap.destroy(bytes);
+}
+
+static void bench_vec(){
+	bench::print_header("vec");
+	constexpr isize count = 4096;
+	auto heap = mem::heap_allocator();
+	auto a = heap.make_slice<vec<f32, 4>>(count);
+	auto b = heap.make_slice<vec<f32, 4>>(count);
+	for(isize i = 0; i < count; i++){
+		a[i] = {{f32(i), 1, 2, 3}};
+		b[i] = {{0.5f, f32(i), 0.25f, 1}};
+	}
+
+	bench::run("vec<f32,4> a + b * 2 (x4096)", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(isize k = 0; k < count; k++){ a[k] = a[k] + b[k] * 2.0f; }
+			bench::clobber();
+		}
+	}, {.bytes_per_op = count * isize(sizeof(vec<f32, 4>)), .items_per_op = count});
+
+	bench::run("vec<f32,4> dot (x4096)", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			f32 acc = 0;
+			for(isize k = 0; k < count; k++){ acc += dot(a[k], b[k]); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.bytes_per_op = 2 * count * isize(sizeof(vec<f32, 4>)), .items_per_op = count});
+
+	bench::run("vec<i32,8> min/max (x4096)", [&](isize n){
+		vec<i32, 8> lo{}, hi{};
+		for(isize i = 0; i < n; i++){
+			for(isize k = 0; k < count; k++){
+				vec<i32, 8> v = {{i32(k), 1, 2, 3, i32(-k), 5, 6, 7}};
+				lo = min(lo, v);
+				hi = max(hi, v);
+			}
+			bench::do_not_optimize(lo);
+			bench::do_not_optimize(hi);
+		}
+	}, {.items_per_op = count});
+
+	heap.destroy(a);
+	heap.destroy(b);
+}
+
+static void bench_sort(){
+	bench::print_header("sort");
+	auto heap = mem::heap_allocator();
+	constexpr isize count = 1000 * 1000;
+	auto input = heap.make_slice<u32>(count);
+	auto work = heap.make_slice<u32>(count);
+	u64 state = 0x9e3779b97f4a7c15;
+	for(isize i = 0; i < count; i++){
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		input[i] = u32(state);
+	}
+
+	/* Every run starts from a copy of the unsorted input, the copy is included */
+	auto reset = [&]{ mem::copy_no_overlap(work.raw_data(), input.raw_data(), count * sizeof(u32)); };
+	bench::Config cfg = {.bytes_per_op = count * isize(sizeof(u32)), .items_per_op = count};
+
+	bench::run("copy only (baseline) 1M u32", [&](isize n){
+		for(isize i = 0; i < n; i++){ reset(); bench::clobber(); }
+	}, cfg);
+
+	bench::run("std::sort 1M u32", [&](isize n){
+		for(isize i = 0; i < n; i++){ reset(); std::sort(work.raw_data(), work.raw_data() + count); }
+	}, cfg);
+
+	bench::run("sort (pdqsort) 1M u32", [&](isize n){
+		for(isize i = 0; i < n; i++){ reset(); sort(work); }
+	}, cfg);
+
+	bench::run("radix_sort 1M u32", [&](isize n){
+		for(isize i = 0; i < n; i++){ reset(); radix_sort(work, heap); }
+	}, cfg);
+
+	bench::run("parallel_sort 1M u32", [&](isize n){
+		for(isize i = 0; i < n; i++){ reset(); parallel_sort(work, heap); }
+	}, cfg);
+
+	constexpr isize queries = 100 * 1000;
+	bench::run("lower_bound 100K queries over 1M", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			isize acc = 0;
+			for(isize q = 0; q < queries; q++){
+				acc += lower_bound(work, input[q]);
+			}
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = queries});
+
+	bench::run("std::lower_bound 100K queries over 1M", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			isize acc = 0;
+			for(isize q = 0; q < queries; q++){
+				acc += std::lower_bound(work.raw_data(), work.raw_data() + count, input[q]) - work.raw_data();
+			}
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = queries});
+
+	heap.destroy(input);
+	heap.destroy(work);
+}
+
+static void bench_hash_map(){
+	bench::print_header("Hash_Map / LRU_Cache");
+	auto heap = mem::heap_allocator();
+	constexpr isize ops = 100 * 1000;
+	auto keys = heap.make_slice<u64>(ops);
+	u64 state = 0x2545f4914f6cdd1d;
+	for(isize i = 0; i < ops; i++){
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		keys[i] = state % (128 * 1024);
+	}
+
+	auto map = Hash_Map<u64, u64>::from(heap, 128 * 1024);
+	for(isize i = 0; i < ops; i++){ (void)map.set(keys[i], i); }
+	bench::run("Hash_Map<u64,u64> get x100K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize k = 0; k < ops; k++){ acc += map.get(keys[k]).ok(); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = ops});
+	map.destroy();
+
+	auto cache = LRU_Cache<u64, u64>::from(heap, 64 * 1024);
+	bench::run("LRU_Cache 64K get-or-put x100K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(isize k = 0; k < ops; k++){
+				if(!cache.get(keys[k]).ok()){ cache.put(keys[k], k); }
+			}
+		}
+	}, {.items_per_op = ops});
+	cache.destroy();
+
+	heap.destroy(keys);
+}
+
+static void bench_btree(){
+	bench::print_header("BTree_Map");
+	auto heap = mem::heap_allocator();
+	constexpr isize count = 1000 * 1000;
+	constexpr isize queries = 100 * 1000;
+	auto keys = heap.make_slice<u64>(count);
+	auto values = heap.make_slice<u64>(count);
+	auto probes = heap.make_slice<u64>(queries);
+	for(isize i = 0; i < count; i++){
+		keys[i] = u64(i) * 16;
+		values[i] = u64(i);
+	}
+	u64 state = 0x853c49e6748fea9b;
+	for(isize i = 0; i < queries; i++){
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		probes[i] = (state % count) * 16;
+	}
+
+	auto map = BTree_Map<u64, u64>::from_sorted(heap, keys, values);
+	std::map<u64, u64> std_map;
+	for(isize i = 0; i < count; i++){ std_map.emplace(keys[i], values[i]); }
+
+	bench::run("BTree_Map get x100K over 1M", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize q = 0; q < queries; q++){ acc += map.get(probes[q]).unwrap_unchecked(); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = queries});
+
+	bench::run("std::map find x100K over 1M", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize q = 0; q < queries; q++){ acc += std_map.find(probes[q])->second; }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = queries});
+
+	constexpr isize span = count / 10;
+	bench::run("BTree_Map range sum 100K entries", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			auto r = map.range(keys[count / 2], keys[count / 2 + span]);
+			for(auto v = r.next(); v.ok(); v = r.next()){
+				auto vals = v.unwrap_unchecked().values;
+				for(isize k = 0; k < vals.len(); k++){ acc += vals[k]; }
+			}
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = span});
+
+	bench::run("std::map range sum 100K entries", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			auto end = std_map.lower_bound(keys[count / 2 + span]);
+			for(auto it = std_map.lower_bound(keys[count / 2]); it != end; ++it){ acc += it->second; }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = span});
+
+	map.destroy();
+	heap.destroy(keys);
+	heap.destroy(values);
+	heap.destroy(probes);
+}
+
+static void bench_radix_tree(){
+	bench::print_header("Radix_Tree");
+	auto heap = mem::heap_allocator();
+	constexpr isize count = 64 * 1024;
+	constexpr isize queries = 100 * 1000;
+	auto storage = heap.make_slice<byte>((count + queries) * 48);
+	auto node_space = heap.make_slice<byte>(32 * mem::MiB);
+	auto strings = mem::Arena::from_bytes(storage);
+	auto nodes = mem::Arena::from_bytes(node_space);
+
+	/* Route-like keys, queries are routes with a random suffix */
+	auto make = [&](u64 a, u64 b, u64 c, cstring tail) -> string {
+		auto buf = (char*)strings.alloc_non_zero(48, 1);
+		int n = snprintf(buf, 48, "/api/v%u/svc%u/item%u%s", unsigned(a), unsigned(b), unsigned(c), tail);
+		return string::from_bytes((byte const*)buf, n);
+	};
+	auto routes = heap.make_slice<string>(count);
+	auto probes = heap.make_slice<string>(queries);
+	u64 state = 0x9e3779b97f4a7c15;
+	auto next = [&]{ state ^= state << 13; state ^= state >> 7; state ^= state << 17; return state; };
+	for(isize i = 0; i < count; i++){ routes[i] = make(i % 4, (i / 4) % 64, i / 256, ""); }
+	for(isize i = 0; i < queries; i++){
+		isize r = next() % count;
+		probes[i] = make(r % 4, (r / 4) % 64, r / 256, "/details");
+	}
+
+	auto tree = Radix_Tree<u64>::from(&nodes);
+	auto map = Hash_Map<string, u64>::from(heap, count * 2);
+	for(isize i = 0; i < count; i++){
+		(void)tree.set(routes[i], i);
+		(void)map.set(routes[i], i);
+	}
+
+	bench::run("Radix_Tree get x64K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize k = 0; k < count; k++){ acc += tree.get(routes[k]).unwrap_unchecked(); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = count});
+
+	bench::run("Hash_Map<string> get x64K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize k = 0; k < count; k++){ acc += map.get(routes[k]).unwrap_unchecked(); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = count});
+
+	bench::run("Radix_Tree longest_prefix x100K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize q = 0; q < queries; q++){ acc += tree.longest_prefix(probes[q]).unwrap_unchecked().value; }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = queries});
+
+	/* Baseline: probe the hash map with every prefix ending before a '/' */
+	bench::run("Hash_Map longest_prefix x100K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			u64 acc = 0;
+			for(isize q = 0; q < queries; q++){
+				string p = probes[q];
+				for(isize end = p.len(); end > 0; end--){
+					if(end < p.len() && p.raw_data()[end] != '/'){ continue; }
+					auto v = map.get(string::from_bytes(p.raw_data(), end));
+					if(v.ok()){ acc += v.unwrap_unchecked(); break; }
+				}
+			}
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = queries});
+
+	map.destroy();
+	heap.destroy(routes);
+	heap.destroy(probes);
+	heap.destroy(node_space);
+	heap.destroy(storage);
+}
+
+static void bench_lock_free(){
+	bench::print_header("Lock_Free_Stack / Lock_Free_Queue");
+	auto heap = mem::heap_allocator();
+	constexpr isize ops = 1000;
+
+	/* Single threaded, measures the fixed cost of CAS, pinning and retiring */
+	auto stack = Lock_Free_Stack<u64>::from(heap);
+	bench::run("Lock_Free_Stack push+pop x1K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(isize k = 0; k < ops; k++){ (void)stack.push(u64(k)); }
+			u64 acc = 0;
+			for(isize k = 0; k < ops; k++){ acc += stack.pop().unwrap_unchecked(); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = ops});
+	stack.destroy();
+
+	auto queue = Lock_Free_Queue<u64>::from(heap);
+	bench::run("Lock_Free_Queue push+pop x1K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(isize k = 0; k < ops; k++){ (void)queue.push(u64(k)); }
+			u64 acc = 0;
+			for(isize k = 0; k < ops; k++){ acc += queue.pop().unwrap_unchecked(); }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = ops});
+	queue.destroy();
+
+	atomic::Spinlock lock;
+	auto arr = Dynamic_Array<u64>::from(heap, ops);
+	bench::run("Spinlock + Dynamic_Array push+pop x1K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(isize k = 0; k < ops; k++){
+				lock.acquire();
+				(void)arr.append(u64(k));
+				lock.release();
+			}
+			u64 acc = 0;
+			for(isize k = 0; k < ops; k++){
+				lock.acquire();
+				acc += arr[arr.len() - 1];
+				arr.pop();
+				lock.release();
+			}
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = ops});
+	arr.destroy();
+}
+
+static void bench_counters(){
+	bench::print_header("Sharded_Counter / Seqlock");
+	constexpr isize threads = 4;
+	constexpr isize ops = 250 * 1000;
+
+	/* Every thread increments, the difference is cache line traffic between cores */
+	std::atomic<i64> shared = 0;
+	bench::run("std::atomic<i64> fetch_add, 4 threads x250K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			std::thread workers[threads];
+			for(auto& w : workers){
+				w = std::thread([&]{
+					for(isize k = 0; k < ops; k++){ atomic::fetch_add(&shared, i64(1), atomic::Memory_Order::relaxed); }
+				});
+			}
+			for(auto& w : workers){ w.join(); }
+		}
+		bench::do_not_optimize(atomic::load(&shared, atomic::Memory_Order::relaxed));
+	}, {.items_per_op = threads * ops});
+
+	static atomic::Sharded_Counter<> counter;
+	bench::run("Sharded_Counter add, 4 threads x250K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			std::thread workers[threads];
+			for(auto& w : workers){
+				w = std::thread([&]{
+					for(isize k = 0; k < ops; k++){ counter.increment(); }
+				});
+			}
+			for(auto& w : workers){ w.join(); }
+		}
+		bench::do_not_optimize(counter.load());
+	}, {.items_per_op = threads * ops});
+
+	struct Snapshot { u64 version; f64 values[6]; };
+	static atomic::Seqlock<Snapshot> seqlock;
+	Snapshot snapshot = {};
+	atomic::Spinlock lock;
+	seqlock.store(snapshot);
+	constexpr isize reads = 1000;
+	bench::run("Seqlock load x1K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			f64 acc = 0;
+			for(isize k = 0; k < reads; k++){ acc += seqlock.load().values[k % 6]; }
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = reads});
+
+	bench::run("Spinlock + copy x1K", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			f64 acc = 0;
+			for(isize k = 0; k < reads; k++){
+				lock.acquire();
+				Snapshot s = snapshot;
+				lock.release();
+				acc += s.values[k % 6];
+			}
+			bench::do_not_optimize(acc);
+		}
+	}, {.items_per_op = reads});
+}
+
+static void bench_io(){
+	bench::print_header("io");
+	auto heap = mem::heap_allocator();
+	constexpr isize size = 1 * mem::MiB;
+	auto text = heap.make_slice<byte>(size);
+	for(isize i = 0; i < size; i++){
+		text[i] = (i % 120 == 119) ? '\n' : 'x';
+	}
+
+	bench::run("find_byte newline, 120 byte lines 1MiB", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			isize lines = 0;
+			for(isize off = 0;;){
+				isize pos = io::find_byte(&text[off], size - off, '\n');
+				if(pos < 0){ break; }
+				off += pos + 1;
+				lines += 1;
+			}
+			bench::do_not_optimize(lines);
+		}
+	}, {.bytes_per_op = size});
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	static byte out_storage[64 * 1024];
+	auto writer = io::Buffered_Writer::from(null_fd, slice<byte>::from(out_storage, sizeof(out_storage)));
+	bench::run("Buffered_Writer 1000 int + float lines", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(i32 k = 0; k < 1000; k++){
+				writer.write_int(k * 7919);
+				writer.write(byte(' '));
+				writer.write_float(f64(k) * 0.25);
+				writer.write(byte('\n'));
+			}
+		}
+		writer.flush();
+	}, {.items_per_op = 1000});
+
+	FILE* null_file = fdopen(dup(null_fd), "w");
+	bench::run("fprintf 1000 int + float lines", [&](isize n){
+		for(isize i = 0; i < n; i++){
+			for(i32 k = 0; k < 1000; k++){
+				fprintf(null_file, "%d %g\n", k * 7919, f64(k) * 0.25);
+			}
+		}
+		fflush(null_file);
+	}, {.items_per_op = 1000});
+	fclose(null_file);
+	close(null_fd);
+
+	/* Many small files: io_uring batch vs one pread() per file */
+	constexpr isize file_count = 512;
+	constexpr isize file_size = 4096;
+	char dir[] = "/tmp/bench_io_XXXXXX";
+	if(mkdtemp(dir)){
+		int fds[file_count];
+		char path[64];
+		for(isize i = 0; i < file_count; i++){
+			snprintf(path, sizeof(path), "%s/%d", dir, int(i));
+			fds[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			[[maybe_unused]] auto _ = write(fds[i], text.raw_data(), file_size);
+		}
+		auto arena_mem = heap.make_slice<byte>(file_count * (file_size + 256) + 4096);
+		auto fd_slice = slice<int>::from(fds, file_count);
+
+		for(bool use_uring : {true, false}){
+			auto reader = io::Async_Reader::from(256, use_uring);
+			cstring name = reader.using_fallback() ? "pread 512 x 4KiB files" : "io_uring 512 x 4KiB files";
+			bench::run(name, [&](isize n){
+				for(isize i = 0; i < n; i++){
+					auto arena = mem::Arena::from_bytes(arena_mem);
+					auto batch = io::make_file_batch(&arena, fd_slice);
+					io::run_batch(&reader, batch);
+					bench::do_not_optimize(batch->requests[0].result);
+				}
+			}, {.bytes_per_op = file_count * file_size, .items_per_op = file_count});
+			reader.destroy();
+		}
+
+		for(isize i = 0; i < file_count; i++){
+			close(fds[i]);
+			snprintf(path, sizeof(path), "%s/%d", dir, int(i));
+			unlink(path);
+		}
+		rmdir(dir);
+		heap.destroy(arena_mem);
+	}
+
+	heap.destroy(text);
+}
+
+int main(){
+	bench_temporal();
+	bench_arena();
+	bench_dynamic_array();
+	bench_string();
+	bench_utf8();
+	bench_vec();
+	bench_sort();
+	bench_hash_map();
+	bench_btree();
+	bench_radix_tree();
+	bench_lock_free();
+	bench_counters();
+	bench_io();
+}
@@ -10,6 +10,12 @@ Run(){ echo "$@"; $@ ; }
 case $BuildMode in
 	"sanitize") Run $CXX $CFLAGS -o main.bin main.cpp $LDFLAGS -fsanitize=address -lasan ;;
 	"dist") Run $CXX $CFLAGS -O2 -o main.bin main.cpp $LDFLAGS ;;
+	"bench") Run $CXX $CFLAGS -O2 -o bench.bin bench.cpp $LDFLAGS ; ./bench.bin ; exit ;;
+	"bench-noexcept")
+		Run $CXX $CFLAGS -O2 -c -o bench.o bench.cpp
+		Run $CXX $CFLAGS -O2 -fno-exceptions -c -o bench_noexcept.o bench.cpp
+		size bench.o bench_noexcept.o
+		Run $CXX -o bench_noexcept.bin bench_noexcept.o $LDFLAGS ; ./bench_noexcept.bin ; exit ;;
 	*) Run $CXX $CFLAGS -O0 -g -o main.bin main.cpp $LDFLAGS ;;
 esac
 
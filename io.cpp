@@ -0,0 +1,914 @@
+/* POSIX I/O on top of the prelude: buffered readers and writers over file
+ * descriptors, batched async reads and memory mapped files. Include after prelude.hpp, requires a
+ * POSIX system. */
+#pragma once
+#include "prelude.hpp"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <charconv>
+#include <mutex>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace io {
+enum struct Read_Error : u8 {
+	none = 0,
+	eof,
+	io_error,
+	line_too_long, /* Delimiter not found within a full buffer, see Buffered_Reader::skip_until() */
+};
+
+// Index of the first `b` in `data[0..n)`, or -1. Compares a whole vector
+// register of bytes per step.
+static inline
+isize find_byte(byte const* data, isize n, byte b){
+	constexpr isize W = _vec_native::max_width;
+	using Block = vec<u8, W>;
+	Block needle;
+	for(isize i = 0; i < W; i++){ needle[i] = b; }
+
+	isize i = 0;
+	for(; i + W <= n; i += W){
+		Block chunk;
+		mem::copy_no_overlap(&chunk, &data[i], W);
+		auto eq = chunk == needle;
+		if(!any(eq)){ continue; }
+
+		auto words = bit_cast<vec<u64, W / 8>>(eq);
+		for(isize w = 0; w < W / 8; w++){
+			if(words[w] != 0){
+				return i + w * 8 + std::countr_zero(words[w]) / 8;
+			}
+		}
+	}
+	for(; i < n; i++){
+		if(data[i] == b){ return i; }
+	}
+	return -1;
+}
+
+// Reads from a file descriptor through a reusable buffer. Strings returned by
+// read_until() and read_line() point into the buffer and are only valid until
+// the next call on the reader. The buffer is only refilled (compacting any
+// pending bytes to its start) when a record crosses its end.
+struct Buffered_Reader {
+	int fd = -1;
+	slice<byte> buffer;
+	isize start = 0; /* First unconsumed byte */
+	isize end = 0;   /* End of valid data */
+	bool reached_eof = false;
+	mem::Allocator allocator;
+
+	static Result<Buffered_Reader, mem::Allocator_Error> from(int fd, mem::Allocator allocator, isize buffer_size = 1 * mem::MiB){
+		assert(buffer_size > 0, "Buffer size must be positive");
+		auto res = allocator.try_alloc_non_zero(buffer_size, 1);
+		if(!res.ok()){ return res.unwrap_err(); }
+
+		Buffered_Reader r;
+		r.fd = fd;
+		r.allocator = allocator;
+		r.buffer = slice<byte>::from((byte*)res.unwrap(), buffer_size);
+		return r;
+	}
+
+	// Bytes up to (not including) the next `delim`, which is consumed. The last
+	// record of the input may have no delimiter. A record longer than the buffer
+	// gives line_too_long and is left unread, call skip_until(delim) to drop it
+	// and continue with the next record.
+	Result<string, Read_Error> read_until(byte delim){
+		isize scanned = 0;
+		for(;;){
+			byte* data = buffer.raw_data();
+			isize pos = find_byte(&data[start + scanned], end - start - scanned, delim);
+			if(pos >= 0){
+				isize len = scanned + pos;
+				string s = string::from_bytes(&data[start], len);
+				start += len + 1;
+				return s;
+			}
+			scanned = end - start;
+
+			if(reached_eof){
+				if(start == end){ return Read_Error::eof; }
+				string s = string::from_bytes(&data[start], end - start);
+				start = end;
+				return s;
+			}
+
+			if(start == 0 && end == buffer.len()){
+				return Read_Error::line_too_long;
+			}
+
+			auto err = fill();
+			if(err != Read_Error::none && err != Read_Error::eof){
+				return err;
+			}
+		}
+	}
+
+	// Discard everything up to and including the next `delim`. Returns eof if
+	// the input ended first, having discarded the remainder.
+	Read_Error skip_until(byte delim){
+		for(;;){
+			byte* data = buffer.raw_data();
+			isize pos = find_byte(&data[start], end - start, delim);
+			if(pos >= 0){
+				start += pos + 1;
+				return Read_Error::none;
+			}
+			start = end;
+			if(reached_eof){ return Read_Error::eof; }
+
+			auto err = fill();
+			if(err == Read_Error::io_error){ return err; }
+		}
+	}
+
+	// Next line without its line ending ("\n" or "\r\n")
+	Result<string, Read_Error> read_line(){
+		auto res = read_until('\n');
+		if(!res.ok()){ return res; }
+
+		string line = res.unwrap_unchecked();
+		if(line.len() > 0 && line.raw_data()[line.len() - 1] == '\r'){
+			line = line.sub(0, line.len() - 1);
+		}
+		return line;
+	}
+
+	// Copy up to out.len() bytes, returns number of bytes read (0 on EOF) or -1 on error
+	isize read(slice<byte> out){
+		if(start == end && !reached_eof){
+			if(out.len() >= buffer.len()){
+				return _read_fd(out.raw_data(), out.len());
+			}
+			if(fill() == Read_Error::io_error){ return -1; }
+		}
+		isize n = min(out.len(), end - start);
+		mem::copy_no_overlap(out.raw_data(), &buffer.raw_data()[start], n);
+		start += n;
+		return n;
+	}
+
+	// Move pending bytes to the start of the buffer and read more after them
+	Read_Error fill(){
+		byte* data = buffer.raw_data();
+		if(start > 0){
+			mem::copy(data, &data[start], end - start);
+			end -= start;
+			start = 0;
+		}
+
+		isize n = _read_fd(&data[end], buffer.len() - end);
+		if(n < 0){ return Read_Error::io_error; }
+		if(n == 0){
+			reached_eof = true;
+			return Read_Error::eof;
+		}
+		end += n;
+		return Read_Error::none;
+	}
+
+	isize _read_fd(byte* dst, isize n){
+		for(;;){
+			isize res = ::read(fd, dst, n);
+			if(res < 0 && errno == EINTR){ continue; }
+			return res;
+		}
+	}
+
+	void destroy(){
+		allocator.destroy(buffer);
+		buffer = {};
+		start = end = 0;
+	}
+};
+}
+
+/* ---------------- Buffered writer ---------------- */
+namespace io {
+constexpr inline char _digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// Writes decimal digits of `v` ending right before `end`, returns pointer to the first digit
+static inline
+byte* _format_u64(byte* end, u64 v){
+	byte* p = end;
+	while(v >= 100){
+		u64 pair = (v % 100) * 2;
+		v /= 100;
+		p -= 2;
+		p[0] = _digit_pairs[pair];
+		p[1] = _digit_pairs[pair + 1];
+	}
+	if(v >= 10){
+		p -= 2;
+		p[0] = _digit_pairs[v * 2];
+		p[1] = _digit_pairs[v * 2 + 1];
+	}
+	else {
+		p -= 1;
+		p[0] = '0' + v;
+	}
+	return p;
+}
+
+// Writes to a file descriptor through a fixed, caller provided buffer. Nothing
+// is allocated: the buffer is flushed when full, when flush() is called, or
+// when a write is larger than the buffer, in which case the buffered bytes and
+// the payload are sent together with a single writev().
+struct Buffered_Writer {
+	int fd = -1;
+	slice<byte> buffer;
+	isize length = 0;
+	bool failed = false; /* Set once a write to fd fails, later output is dropped */
+
+	static Buffered_Writer from(int fd, slice<byte> buffer){
+		assert(buffer.len() > 0, "Writer buffer must not be empty");
+		Buffered_Writer w;
+		w.fd = fd;
+		w.buffer = buffer;
+		return w;
+	}
+
+	bool flush(){
+		if(length > 0 && !failed){
+			failed = !_write_fd(buffer.raw_data(), length);
+		}
+		length = 0;
+		return !failed;
+	}
+
+	void write(slice<byte> data){
+		isize n = data.len();
+		if(n <= buffer.len() - length){
+			mem::copy_no_overlap(&buffer.raw_data()[length], data.raw_data(), n);
+			length += n;
+			return;
+		}
+		if(n < buffer.len()){
+			flush();
+			mem::copy_no_overlap(buffer.raw_data(), data.raw_data(), n);
+			length = n;
+			return;
+		}
+
+		/* Large payload: send buffered bytes and payload in one syscall */
+		if(failed){ return; }
+		iovec parts[2] = {
+			{buffer.raw_data(), usize(length)},
+			{data.raw_data(), usize(n)},
+		};
+		isize total = length + n;
+		isize written = _writev_fd(parts, 2);
+		if(written >= 0 && written < total){
+			/* Short write, push out whatever is left */
+			isize from_buf = min(written, length);
+			bool ok = _write_fd(&buffer.raw_data()[from_buf], length - from_buf);
+			isize from_data = written - from_buf;
+			failed = !ok || !_write_fd(&data.raw_data()[from_data], n - from_data);
+		}
+		else {
+			failed = written < 0;
+		}
+		length = 0;
+	}
+
+	void write(string s){
+		write(slice<byte>::from((byte*)s.raw_data(), s.len()));
+	}
+
+	void write(byte b){
+		if(length >= buffer.len()){
+			flush();
+		}
+		buffer.raw_data()[length] = b;
+		length += 1;
+	}
+
+	void write_uint(u64 v){
+		byte tmp[24];
+		byte* first = _format_u64(&tmp[24], v);
+		write(slice<byte>::from(first, &tmp[24] - first));
+	}
+
+	void write_int(i64 v){
+		byte tmp[24];
+		u64 mag = v < 0 ? ~u64(v) + 1 : u64(v);
+		byte* first = _format_u64(&tmp[24], mag);
+		if(v < 0){
+			first -= 1;
+			*first = '-';
+		}
+		write(slice<byte>::from(first, &tmp[24] - first));
+	}
+
+	// Shortest representation that parses back to the same value
+	template<typename F>
+	void write_float(F v){
+		char tmp[64];
+		auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+		write(slice<byte>::from((byte*)tmp, res.ptr - tmp));
+	}
+
+	// Format any value supported by io::format()
+	template<typename T>
+	void write_value(T const& v);
+
+	bool _write_fd(byte const* data, isize n){
+		while(n > 0){
+			isize res = ::write(fd, data, n);
+			if(res < 0){
+				if(errno == EINTR){ continue; }
+				return false;
+			}
+			data += res;
+			n -= res;
+		}
+		return true;
+	}
+
+	isize _writev_fd(iovec* parts, int count){
+		for(;;){
+			isize res = ::writev(fd, parts, count);
+			if(res < 0 && errno == EINTR){ continue; }
+			return res;
+		}
+	}
+};
+
+/* Formatting */
+static inline void format(Buffered_Writer* w, string s){ w->write(s); }
+static inline void format(Buffered_Writer* w, cstring s){ w->write(string(s)); }
+static inline void format(Buffered_Writer* w, bool b){ w->write(b ? string("true") : string("false")); }
+
+// Byte sized integers (char, i8, u8) print as characters, like iostreams
+template<typename T> requires (std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>)
+static inline void format(Buffered_Writer* w, T c){ w->write(byte(c)); }
+
+template<typename T> requires (std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) > 1)
+static inline void format(Buffered_Writer* w, T v){ w->write_int(v); }
+
+template<typename T> requires (std::is_integral_v<T> && std::is_unsigned_v<T> && sizeof(T) > 1)
+static inline void format(Buffered_Writer* w, T v){ w->write_uint(v); }
+
+template<typename T> requires std::is_floating_point_v<T>
+static inline void format(Buffered_Writer* w, T v){ w->write_float(v); }
+
+template<typename T, int N>
+static inline void format(Buffered_Writer* w, vec<T, N> const& v){
+	w->write(string("[ "));
+	for(int i = 0; i < N; i++){
+		format(w, v[i]);
+		w->write(byte(' '));
+	}
+	w->write(byte(']'));
+}
+
+template<typename T>
+static inline void format(Buffered_Writer* w, slice<T> s){
+	w->write(string("[ "));
+	for(isize i = 0; i < s.len(); i++){
+		format(w, s[i]);
+		w->write(byte(' '));
+	}
+	w->write(byte(']'));
+}
+
+template<typename T>
+static inline void format(Buffered_Writer* w, Dynamic_Array<T> const& arr){
+	format(w, slice<T>::from(arr.data, arr.len()));
+}
+
+template<int N>
+static inline void format(Buffered_Writer* w, Bit_Vec<N> const& bits){
+	for(isize i = 0; i < N; i++){
+		w->write(byte('0' + bits.get(i)));
+	}
+}
+
+template<typename T>
+static inline void format(Buffered_Writer* w, Option<T> const& opt){
+	if(opt.ok()){
+		format(w, opt.unwrap_unchecked());
+	} else {
+		w->write(string("<Option: empty>"));
+	}
+}
+
+template<typename T, typename E>
+static inline void format(Buffered_Writer* w, Result<T, E> const& res){
+	if(res.ok()){
+		format(w, res.unwrap_unchecked());
+	} else {
+		w->write(string("<Result: error>"));
+	}
+}
+
+template<typename T>
+void Buffered_Writer::write_value(T const& v){
+	format(this, v);
+}
+
+// Process wide stdout writer. Line buffered when stdout is a terminal,
+// otherwise flushed when full and at exit. print() and flush_stdout() hold
+// `lock` while touching the writer, so lines from different threads never
+// interleave. It is a blocking mutex since holders may be stuck in write().
+struct _Stdout_State {
+	byte storage[64 * 1024];
+	Buffered_Writer writer;
+	bool line_buffered;
+	std::mutex lock;
+
+	_Stdout_State(){
+		writer = Buffered_Writer::from(STDOUT_FILENO, slice<byte>::from(storage, sizeof(storage)));
+		line_buffered = ::isatty(STDOUT_FILENO);
+	}
+
+	~_Stdout_State(){
+		writer.flush();
+	}
+};
+
+inline _Stdout_State& _stdout_state(){
+	static _Stdout_State state;
+	return state;
+}
+
+// Unsynchronized access to the stdout writer, for single threaded programs
+// or callers that hold stdout_lock()
+inline Buffered_Writer& stdout_writer(){
+	return _stdout_state().writer;
+}
+
+inline std::mutex& stdout_lock(){
+	return _stdout_state().lock;
+}
+
+inline void flush_stdout(){
+	auto& state = _stdout_state();
+	state.lock.lock();
+	defer(state.lock.unlock());
+	state.writer.flush();
+}
+}
+
+// Print arguments separated by spaces, followed by a newline. Safe to call
+// from multiple threads.
+template<typename T, typename ...Rest>
+void print(T const& first, Rest const& ...rest){
+	auto& state = io::_stdout_state();
+	state.lock.lock();
+	defer(state.lock.unlock());
+	auto& w = state.writer;
+	w.write_value(first);
+	((w.write(byte(' ')), w.write_value(rest)), ...);
+	w.write(byte('\n'));
+	if(state.line_buffered){
+		w.flush();
+	}
+}
+
+/* ---------------- Memory mapped files ---------------- */
+namespace mem {
+enum struct Map_Error : u8 {
+	none = 0,
+	open_failed,
+	stat_failed,
+	map_failed,
+};
+
+// Access pattern hints for map_file(), passed to madvise()
+constexpr inline u32 map_sequential = 1 << 0; /* Aggressive read-ahead, pages can be dropped after access */
+constexpr inline u32 map_random     = 1 << 1; /* No read-ahead */
+constexpr inline u32 map_will_need  = 1 << 2; /* Start reading the whole file in now */
+constexpr inline u32 map_huge_pages = 1 << 3; /* Back with transparent huge pages where supported */
+constexpr inline u32 map_populate   = 1 << 4; /* Pre-fault all pages at map time (Linux) */
+
+static inline
+Result<slice<byte>, Map_Error> _map_file(cstring path, u32 hints, bool writable){
+	int fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+	if(fd < 0){ return Map_Error::open_failed; }
+	defer(::close(fd));
+
+	struct stat info;
+	if(::fstat(fd, &info) < 0){ return Map_Error::stat_failed; }
+	isize size = info.st_size;
+	if(size == 0){ return slice<byte>{}; }
+
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if(hints & map_populate){ flags |= MAP_POPULATE; }
+#endif
+	int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	void* p = ::mmap(nullptr, size, prot, flags, fd, 0);
+	if(p == MAP_FAILED){ return Map_Error::map_failed; }
+
+	/* Advice is best-effort, failures are ignored */
+	if(hints & map_sequential){ ::madvise(p, size, MADV_SEQUENTIAL); }
+	if(hints & map_random){ ::madvise(p, size, MADV_RANDOM); }
+	if(hints & map_will_need){ ::madvise(p, size, MADV_WILLNEED); }
+#ifdef MADV_HUGEPAGE
+	if(hints & map_huge_pages){ ::madvise(p, size, MADV_HUGEPAGE); }
+#endif
+
+	return slice<byte>::from((byte*)p, size);
+}
+
+// Map a whole file read-only. Release with unmap(), e.g. defer(mem::unmap(data))
+static inline
+Result<slice<byte>, Map_Error> map_file(cstring path, u32 hints = 0){
+	return _map_file(path, hints, false);
+}
+
+// Map a whole file read-write, writes go through to the file (see sync_mapped())
+static inline
+Result<slice<byte>, Map_Error> map_file_rw(cstring path, u32 hints = 0){
+	return _map_file(path, hints, true);
+}
+
+// View of a mapped file as text
+static inline
+string mapped_string(slice<byte> data){
+	return string::from_bytes(data.raw_data(), data.len());
+}
+
+// Flush writes to a read-write mapping back to the file
+static inline
+bool sync_mapped(slice<byte> data){
+	if(data.len() == 0){ return true; }
+	return ::msync(data.raw_data(), data.len(), MS_SYNC) == 0;
+}
+
+static inline
+void unmap(slice<byte> data){
+	if(data.len() == 0){ return; }
+	::munmap(data.raw_data(), data.len());
+}
+}
+
+/* ---------------- Async file reads ---------------- */
+// Batched positioned reads through io_uring, driven with raw syscalls. When the
+// ring can't be set up (old kernel, seccomp, non-Linux) the reader falls back
+// to synchronous pread() behind the same interface.
+namespace io {
+struct Read_Batch;
+
+// A single positioned read. Must stay at a stable address until completed.
+// Short reads are continued until the buffer is full, so a result below
+// buffer.len() means the file ended first.
+struct Read_Request {
+	int fd = -1;
+	i64 offset = 0;
+	slice<byte> buffer;
+	isize result = 0; /* Bytes read, or -errno on failure */
+	void* user_data = nullptr;
+	Read_Batch* batch = nullptr;
+	Read_Request* _next = nullptr; /* Completion list in fallback mode, retry list with io_uring */
+	isize _done = 0; /* Bytes read by earlier partial reads */
+};
+
+// Largest single read the kernel performs (MAX_RW_COUNT), longer buffers are
+// read in several steps
+constexpr inline isize max_read_size = 0x7ffff000;
+
+// Group of requests, `remaining` is decremented (release) as each completes so
+// other threads can wait on it with done()
+struct Read_Batch {
+	slice<Read_Request> requests;
+	std::atomic<isize> remaining = 0;
+
+	bool done(){
+		return atomic::load(&remaining, atomic::Memory_Order::acquire) == 0;
+	}
+};
+
+using Read_Callback = void (*)(Read_Request* req, void* ctx);
+
+struct Async_Reader {
+	int ring_fd = -1;
+	u32 sq_entries = 0;
+	u32 cq_entries = 0;
+	isize in_flight = 0;  /* Queued or submitted, not yet reaped */
+	u32 unsubmitted = 0;
+
+#ifdef __linux__
+	/* Ring state shared with the kernel */
+	std::atomic<u32>* sq_head = nullptr;
+	std::atomic<u32>* sq_tail = nullptr;
+	u32 sq_mask = 0;
+	u32* sq_array = nullptr;
+	io_uring_sqe* sqes = nullptr;
+	std::atomic<u32>* cq_head = nullptr;
+	std::atomic<u32>* cq_tail = nullptr;
+	u32 cq_mask = 0;
+	io_uring_cqe* cqes = nullptr;
+	slice<byte> sq_map;
+	slice<byte> cq_map;
+	slice<byte> sqe_map;
+#endif
+
+	Read_Request* _done_first = nullptr;
+	Read_Request* _done_last = nullptr;
+	Read_Request* _retry_first = nullptr; /* Partially read, waiting for a free SQE */
+	Read_Request* _retry_last = nullptr;
+
+	bool using_fallback() const {
+		return ring_fd < 0;
+	}
+
+	static Async_Reader from(u32 entries = 256, bool use_uring = true){
+		Async_Reader r;
+#ifdef __linux__
+		if(use_uring){
+			r._setup_ring(entries);
+		}
+#else
+		(void)entries; (void)use_uring;
+#endif
+		return r;
+	}
+
+	// Add a read to the submission queue, returns false when the ring is full
+	// (call submit()/wait() to make room). In fallback mode the read happens
+	// immediately and is reported by the next poll()/wait().
+	bool queue(Read_Request* req){
+		if(using_fallback()){
+			req->result = _pread_fd(req->fd, req->buffer, req->offset);
+			req->_next = nullptr;
+			if(_done_last){ _done_last->_next = req; } else { _done_first = req; }
+			_done_last = req;
+			in_flight += 1;
+			return true;
+		}
+#ifdef __linux__
+		if(in_flight >= isize(cq_entries)){
+			return false;
+		}
+		req->_done = 0;
+		if(!_push_sqe(req)){
+			return false;
+		}
+		in_flight += 1;
+#endif
+		return true;
+	}
+
+	// Hand queued reads to the kernel, one syscall for the whole batch
+	isize submit(){
+		return _enter(0);
+	}
+
+	// Reap finished reads without blocking, returns how many completed
+	isize poll(Read_Callback callback = nullptr, void* ctx = nullptr){
+		if(unsubmitted > 0 || _retry_first){ submit(); }
+		return _reap(callback, ctx);
+	}
+
+	// Submit and block until at least `min_complete` reads (capped at what is
+	// in flight) have completed. Returns the number reaped, or -1 on error.
+	isize wait(isize min_complete, Read_Callback callback = nullptr, void* ctx = nullptr){
+		min_complete = ::min(min_complete, in_flight);
+		isize reaped = _reap(callback, ctx);
+		while(reaped < min_complete || unsubmitted > 0 || _retry_first){
+			/* Only wait for events while short of the target, io_uring_enter
+			 * blocks if asked for more completions than are in flight */
+			isize want = ::max(min_complete - reaped, isize(0));
+			if(_enter(u32(want)) < 0){
+				return -1;
+			}
+			reaped += _reap(callback, ctx);
+		}
+		return reaped;
+	}
+
+	void destroy(){
+#ifdef __linux__
+		if(ring_fd >= 0){
+			::munmap(sqe_map.raw_data(), sqe_map.len());
+			if(cq_map.raw_data() != sq_map.raw_data()){
+				::munmap(cq_map.raw_data(), cq_map.len());
+			}
+			::munmap(sq_map.raw_data(), sq_map.len());
+			::close(ring_fd);
+		}
+#endif
+		ring_fd = -1;
+	}
+
+	static void _complete(Read_Request* req, Read_Callback callback, void* ctx){
+		if(req->batch){
+			atomic::fetch_sub(&req->batch->remaining, isize(1), atomic::Memory_Order::release);
+		}
+		if(callback){
+			callback(req, ctx);
+		}
+	}
+
+	// Read until `buf` is full or the file ends, returns bytes read or -errno
+	static isize _pread_fd(int fd, slice<byte> buf, i64 offset){
+		isize total = 0;
+		while(total < buf.len()){
+			isize n = ::pread(fd, &buf.raw_data()[total], ::min(buf.len() - total, max_read_size), offset + total);
+			if(n < 0 && errno == EINTR){ continue; }
+			if(n < 0){ return -errno; }
+			if(n == 0){ break; }
+			total += n;
+		}
+		return total;
+	}
+
+	isize _reap(Read_Callback callback, void* ctx){
+		isize count = 0;
+		if(using_fallback()){
+			while(_done_first){
+				Read_Request* req = _done_first;
+				_done_first = req->_next;
+				in_flight -= 1;
+				count += 1;
+				_complete(req, callback, ctx);
+			}
+			_done_last = nullptr;
+			return count;
+		}
+#ifdef __linux__
+		u32 head = atomic::load(cq_head, atomic::Memory_Order::relaxed);
+		u32 tail = atomic::load(cq_tail, atomic::Memory_Order::acquire);
+		for(; head != tail; head++){
+			io_uring_cqe* cqe = &cqes[head & cq_mask];
+			auto req = (Read_Request*)uintptr(cqe->user_data);
+			isize res = cqe->res;
+			/* Release the slot before the callback so it may queue more reads */
+			atomic::store(cq_head, head + 1, atomic::Memory_Order::release);
+
+			if(res > 0 && req->_done + res < req->buffer.len()){
+				/* Short read, continue after the bytes already in the buffer */
+				req->_done += res;
+				if(!_push_sqe(req)){
+					req->_next = nullptr;
+					if(_retry_last){ _retry_last->_next = req; } else { _retry_first = req; }
+					_retry_last = req;
+				}
+				continue;
+			}
+			req->result = res < 0 ? res : req->_done + res;
+			in_flight -= 1;
+			count += 1;
+			_complete(req, callback, ctx);
+		}
+#endif
+		return count;
+	}
+
+	isize _enter(u32 min_complete){
+		if(using_fallback()){ return 0; }
+#ifdef __linux__
+		while(_retry_first && _push_sqe(_retry_first)){
+			_retry_first = _retry_first->_next;
+			if(!_retry_first){ _retry_last = nullptr; }
+		}
+		for(;;){
+			u32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+			long res = ::syscall(__NR_io_uring_enter, ring_fd, unsubmitted, min_complete, flags, nullptr, 0);
+			if(res < 0){
+				if(errno == EINTR){ continue; }
+				return -1;
+			}
+			unsubmitted -= u32(res);
+			return res;
+		}
+#else
+		(void)min_complete;
+		return 0;
+#endif
+	}
+
+#ifdef __linux__
+	// Fill the next SQE with the unread part of `req`, false if the ring is full
+	bool _push_sqe(Read_Request* req){
+		u32 tail = atomic::load(sq_tail, atomic::Memory_Order::relaxed);
+		u32 head = atomic::load(sq_head, atomic::Memory_Order::acquire);
+		if(tail - head >= sq_entries){
+			return false;
+		}
+		u32 index = tail & sq_mask;
+		io_uring_sqe* sqe = &sqes[index];
+		mem::set(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = req->fd;
+		sqe->off = u64(req->offset + req->_done);
+		sqe->addr = u64(uintptr(&req->buffer.raw_data()[req->_done]));
+		sqe->len = u32(::min(req->buffer.len() - req->_done, max_read_size));
+		sqe->user_data = u64(uintptr(req));
+		sq_array[index] = index;
+		atomic::store(sq_tail, tail + 1, atomic::Memory_Order::release);
+		unsubmitted += 1;
+		return true;
+	}
+
+	static slice<byte> _map_ring(int fd, isize size, i64 offset){
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+		if(p == MAP_FAILED){ return {}; }
+		return slice<byte>::from((byte*)p, size);
+	}
+
+	void _setup_ring(u32 entries){
+		io_uring_params params;
+		mem::set(&params, 0, sizeof(params));
+		int fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+		if(fd < 0){ return; }
+
+		/* IORING_OP_READ arrived together with this feature bit (5.6) */
+		if(!(params.features & IORING_FEAT_RW_CUR_POS)){
+			::close(fd);
+			return;
+		}
+
+		isize sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+		isize cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+		if(single_map){
+			sq_size = ::max(sq_size, cq_size);
+		}
+
+		sq_map = _map_ring(fd, sq_size, IORING_OFF_SQ_RING);
+		cq_map = single_map ? sq_map : _map_ring(fd, cq_size, IORING_OFF_CQ_RING);
+		sqe_map = _map_ring(fd, params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+		if(sq_map.len() == 0 || cq_map.len() == 0 || sqe_map.len() == 0){
+			if(sqe_map.len()){ ::munmap(sqe_map.raw_data(), sqe_map.len()); }
+			if(cq_map.len() && !single_map){ ::munmap(cq_map.raw_data(), cq_map.len()); }
+			if(sq_map.len()){ ::munmap(sq_map.raw_data(), sq_map.len()); }
+			::close(fd);
+			return;
+		}
+
+		byte* sq = sq_map.raw_data();
+		byte* cq = cq_map.raw_data();
+		sq_head  = (std::atomic<u32>*)&sq[params.sq_off.head];
+		sq_tail  = (std::atomic<u32>*)&sq[params.sq_off.tail];
+		sq_mask  = *(u32*)&sq[params.sq_off.ring_mask];
+		sq_array = (u32*)&sq[params.sq_off.array];
+		sqes     = (io_uring_sqe*)sqe_map.raw_data();
+		cq_head  = (std::atomic<u32>*)&cq[params.cq_off.head];
+		cq_tail  = (std::atomic<u32>*)&cq[params.cq_off.tail];
+		cq_mask  = *(u32*)&cq[params.cq_off.ring_mask];
+		cqes     = (io_uring_cqe*)&cq[params.cq_off.cqes];
+
+		sq_entries = params.sq_entries;
+		cq_entries = params.cq_entries;
+		ring_fd = fd;
+	}
+#endif
+};
+
+// Prepare whole-file reads of `fds`. The batch, its requests and the file
+// buffers are all carved out of `arena`; returns nullptr if it runs out.
+static inline
+Read_Batch* make_file_batch(mem::Arena* arena, slice<int> fds){
+	/* Zeroed memory is a valid empty Read_Batch */
+	auto batch = (Read_Batch*)arena->alloc(sizeof(Read_Batch), alignof(Read_Batch));
+	auto reqs = (Read_Request*)arena->alloc(sizeof(Read_Request) * fds.len(), alignof(Read_Request));
+	if(!batch || (!reqs && fds.len() > 0)){ return nullptr; }
+	batch->requests = slice<Read_Request>::from(reqs, fds.len());
+
+	for(isize i = 0; i < fds.len(); i++){
+		Read_Request* req = &reqs[i];
+		*req = Read_Request{};
+		req->fd = fds[i];
+		req->batch = batch;
+
+		struct stat info;
+		isize size = ::fstat(fds[i], &info) == 0 ? isize(info.st_size) : 0;
+		auto buf = (byte*)arena->alloc_non_zero(size, 1);
+		if(!buf && size > 0){ return nullptr; }
+		req->buffer = slice<byte>::from(buf, size);
+	}
+	atomic::store(&batch->remaining, fds.len(), atomic::Memory_Order::relaxed);
+	return batch;
+}
+
+// Queue every request of `batch`, submitting in ring sized chunks, and block
+// until all of them completed. Returns false if the ring errored out.
+static inline
+bool run_batch(Async_Reader* reader, Read_Batch* batch, Read_Callback callback = nullptr, void* ctx = nullptr){
+	for(isize i = 0; i < batch->requests.len(); i++){
+		while(!reader->queue(&batch->requests[i])){
+			if(reader->wait(1, callback, ctx) < 0){ return false; }
+		}
+	}
+	while(!batch->done()){
+		if(reader->wait(1, callback, ctx) < 0){ return false; }
+	}
+	return true;
+}
+}
@@ -3,6 +3,7 @@
  * be primarily used for "Printf debugging" */
 #pragma once
 #include "prelude.hpp"
+#include "io.cpp" /* print() lives here, on top of io::Buffered_Writer */
 #include <iostream>
 
 template<int N>
@@ -16,17 +17,6 @@ auto& operator<<(std::ostream& os, Bit_Vec<N> s){
 	return os;
 }
 
-template<typename T>
-void print(T x){
-	std::cout << x << '\n';
-}
-
-template<typename T, typename ...Rest>
-void print(T x, Rest... rest){
-	std::cout << x << ' ';
-	print(rest...);
-}
-
 auto& operator<<(std::ostream& os, string s){
 	auto data = s.raw_data();
 	for(isize i = 0; i < s.len(); i ++){
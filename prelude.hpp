@@ -3,6 +3,7 @@
 
 /* ---------------- Definitions ---------------- */
 #include <stddef.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdalign.h>
 #include <stdbool.h>
@@ -11,9 +12,21 @@
 #include <chrono>
 #include <thread>
 #include <bit>
+#include <type_traits>
 #include <source_location>
+#include <new>
+
+#if defined(__FMA__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 #define USE_NOEXCEPT_ON_STDLIB 1
+
+// Allocation failures are thrown as Allocator_Error unless exceptions are
+// disabled, in which case allocators return null (see mem::last_error())
+#if !defined(__cpp_exceptions) && !defined(DISABLE_EXCEPTIONS)
+#define DISABLE_EXCEPTIONS
+#endif
 using std::bit_cast;
 
 #define caller_location \
@@ -78,8 +91,9 @@ T clamp(T lo, T x, T hi){
 	return min(max(lo, x), hi);
 };
 
+// Pointer to the struct containing `Member`, given a pointer to that member
 #define containerof(Ptr, Type, Member) \
-	((Type *)(((void *)(Ptr)) - offsetof(Type, Member)))
+	((Type *)(((byte *)(Ptr)) - offsetof(Type, Member)))
 
 /* ---------------- Defer ---------------- */
 namespace _defer_impl {
@@ -113,9 +127,19 @@ enum struct Memory_Order {
 	seq_cst = int(std::memory_order_seq_cst),
 };
 
+// A failed CAS only loads, so it can't have release semantics
+static inline constexpr
+std::memory_order _failure_order(Memory_Order order){
+	switch(order){
+	case Memory_Order::release: return std::memory_order_relaxed;
+	case Memory_Order::acq_rel: return std::memory_order_acquire;
+	default: return static_cast<std::memory_order>(order);
+	}
+}
+
 template<typename T>
 static inline constexpr
-bool exchange(std::atomic<T>* obj, T desired, Memory_Order order){
+T exchange(std::atomic<T>* obj, T desired, Memory_Order order){
 	return std::atomic_exchange_explicit(obj, desired, static_cast<std::memory_order>(order));
 }
 
@@ -134,13 +158,30 @@ void store(std::atomic<T>* obj, T value, Memory_Order order){
 template<typename T>
 static inline constexpr
 bool compare_exchange_strong(std::atomic<T>* obj, T* expected, T desired, Memory_Order order){
-	return std::atomic_compare_exchange_strong_explicit(obj, expected, desired, static_cast<std::memory_order>(order));
+	return std::atomic_compare_exchange_strong_explicit(obj, expected, desired, static_cast<std::memory_order>(order), _failure_order(order));
+}
+
+template<typename T>
+static inline constexpr
+T fetch_add(std::atomic<T>* obj, T value, Memory_Order order){
+	return std::atomic_fetch_add_explicit(obj, value, static_cast<std::memory_order>(order));
+}
+
+template<typename T>
+static inline constexpr
+T fetch_sub(std::atomic<T>* obj, T value, Memory_Order order){
+	return std::atomic_fetch_sub_explicit(obj, value, static_cast<std::memory_order>(order));
 }
 
 template<typename T>
 static inline constexpr
 bool compare_exchange_weak(std::atomic<T>* obj, T* expected, T desired, Memory_Order order){
-	return std::atomic_compare_exchange_weak_explicit(obj, expected, desired, static_cast<std::memory_order>(order));
+	return std::atomic_compare_exchange_weak_explicit(obj, expected, desired, static_cast<std::memory_order>(order), _failure_order(order));
+}
+
+static inline
+void thread_fence(Memory_Order order){
+	std::atomic_thread_fence(static_cast<std::memory_order>(order));
 }
 }
 
@@ -177,7 +218,7 @@ static inline Duration nanoseconds(i64 t){
 
 static inline Duration microseconds(i64 t){
 	Duration d;
-	d._nsec = t * 1'000'000ll;
+	d._nsec = t * 1'000ll;
 	return d;
 }
 
@@ -211,20 +252,126 @@ static inline System_Time_Point system_now(){
 	return std::chrono::system_clock::now();
 }
 
-struct Stopwatch {
-	High_Res_Time_Point start {};
+// Clock backends provide `Time_Point`, `now()` and `elapsed(start, end)`
+struct High_Res_Clock {
+	using Time_Point = High_Res_Time_Point;
+
+	static Time_Point now(){
+		return high_res_now();
+	}
+
+	static Duration elapsed(Time_Point start, Time_Point end){
+		auto nanosecs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+		return nanoseconds(nanosecs.count());
+	}
+};
+
+// Reads the CPU's cycle counter (TSC on x86, the virtual counter on AArch64),
+// costing a few nanoseconds per read instead of a vDSO clock call. On x86 the
+// tick rate is measured against the steady clock on first use, call
+// calibrate() at startup to keep that wait off the hot path. Other targets
+// fall back to the steady clock.
+struct Cycle_Counter {
+	using Time_Point = u64;
+
+	static constexpr i64 calibration_ns = 10'000'000;
+
+	static inline std::atomic<f64> _ns_per_tick = 0.0; /* 0 until calibrated */
+
+	// Read counter, may be reordered with surrounding instructions
+	static u64 now(){
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+		return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+		u64 v;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+		return v;
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// Read counter once all previous instructions have completed
+	static u64 now_serialized(){
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+		unsigned int aux;
+		return __builtin_ia32_rdtscp(&aux);
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+		u64 v;
+		asm volatile("isb; mrs %0, cntvct_el0" : "=r"(v) : : "memory");
+		return v;
+#else
+		return now();
+#endif
+	}
+
+	// Measure the tick rate and cache it for nanoseconds_per_tick()
+	static f64 calibrate(){
+		f64 ratio = _measure();
+		atomic::store(&_ns_per_tick, ratio, atomic::Memory_Order::relaxed);
+		return ratio;
+	}
+
+	static f64 _measure(){
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+		using Steady = std::chrono::steady_clock;
+		for(;;){
+			auto t0 = Steady::now();
+			u64 c0 = now_serialized();
+			i64 elapsed = 0;
+			do {
+				elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Steady::now() - t0).count();
+			} while(elapsed < calibration_ns);
+			u64 c1 = now_serialized();
+			/* The TSC can go backwards across a migration on broken hardware, measure again */
+			if(c1 > c0){
+				return f64(elapsed) / f64(c1 - c0);
+			}
+		}
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+		u64 freq;
+		asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+		return 1e9 / f64(freq);
+#else
+		return 1.0;
+#endif
+	}
+
+	static f64 nanoseconds_per_tick(){
+		f64 ratio = atomic::load(&_ns_per_tick, atomic::Memory_Order::relaxed);
+		[[unlikely]] if(ratio == 0.0){
+			ratio = calibrate();
+		}
+		return ratio;
+	}
+
+	static Duration to_duration(u64 ticks){
+		return nanoseconds(i64(f64(ticks) * nanoseconds_per_tick()));
+	}
+
+	static Duration elapsed(Time_Point start, Time_Point end){
+		return to_duration(end - start);
+	}
+};
+
+template<typename Clock>
+struct Basic_Stopwatch {
+	typename Clock::Time_Point start {};
 
 	void reset(){
-		start = high_res_now();
+		start = Clock::now();
 	}
 
 	Duration measure() const {
-		auto now = high_res_now();
-		auto nanosecs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start);
-		return nanoseconds(nanosecs.count());
+		return Clock::elapsed(start, Clock::now());
 	}
 };
 
+using Stopwatch = Basic_Stopwatch<High_Res_Clock>;
+
+// Cheaper stopwatch for timing very short operations
+using Cycle_Stopwatch = Basic_Stopwatch<Cycle_Counter>;
+
 }
 
 /* ---------------- Assert & Panic ---------------- */
@@ -294,46 +441,190 @@ void bounds_check(bool predicate, cstring msg, caller_location){
 #undef PRELUDE_NOEXCEPT
 
 /* ---------------- Option type ---------------- */
+// Types with a spare bit pattern that can stand for "no value", letting Option
+// store just the value instead of value + flag. Specialize to opt a type in.
 template<typename T>
-struct Option {
+struct Option_Niche {
+	static constexpr bool enabled = false;
+};
+
+// NOTE: Option<T*> can't hold a null pointer, Option<T*>(nullptr) is empty
+template<typename T>
+struct Option_Niche<T*> {
+	static constexpr bool enabled = true;
+	static constexpr T* empty(){ return nullptr; }
+	static constexpr bool is_empty(T* const& p){ return p == nullptr; }
+};
+
+template<typename T, bool = Option_Niche<T>::enabled>
+struct _Option_Storage {
 	union { T _value; };
 	bool _has_value = false;
 
-	T unwrap(caller_location) const {
-		if(!_has_value){
+	constexpr bool _has() const { return _has_value; }
+
+	template<typename U>
+	void _emplace(U&& x){
+		new (&_value) T(static_cast<U&&>(x));
+		_has_value = true;
+	}
+
+	void _reset(){
+		if constexpr(!std::is_trivially_destructible_v<T>){
+			if(_has_value){ _value.~T(); }
+		}
+		_has_value = false;
+	}
+
+	_Option_Storage() : _has_value{false} {}
+
+	_Option_Storage(_Option_Storage const&) requires std::is_trivially_copy_constructible_v<T> = default;
+	_Option_Storage(_Option_Storage const& o) : _has_value{false} {
+		if(o._has_value){ _emplace(o._value); }
+	}
+
+	_Option_Storage(_Option_Storage&&) requires std::is_trivially_move_constructible_v<T> = default;
+	_Option_Storage(_Option_Storage&& o) : _has_value{false} {
+		if(o._has_value){ _emplace(static_cast<T&&>(o._value)); }
+	}
+
+	_Option_Storage& operator=(_Option_Storage const&) requires std::is_trivially_copyable_v<T> = default;
+	_Option_Storage& operator=(_Option_Storage const& o){
+		if(this != &o){
+			_reset();
+			if(o._has_value){ _emplace(o._value); }
+		}
+		return *this;
+	}
+
+	_Option_Storage& operator=(_Option_Storage&&) requires std::is_trivially_copyable_v<T> = default;
+	_Option_Storage& operator=(_Option_Storage&& o){
+		if(this != &o){
+			_reset();
+			if(o._has_value){ _emplace(static_cast<T&&>(o._value)); }
+		}
+		return *this;
+	}
+
+	~_Option_Storage() requires std::is_trivially_destructible_v<T> = default;
+	~_Option_Storage(){ _reset(); }
+};
+
+template<typename T>
+struct _Option_Storage<T, true> {
+	static_assert(std::is_trivially_copyable_v<T>, "Niche optimized types must be trivially copyable");
+	T _value = Option_Niche<T>::empty();
+
+	constexpr bool _has() const { return !Option_Niche<T>::is_empty(_value); }
+
+	template<typename U>
+	void _emplace(U&& x){
+		_value = static_cast<U&&>(x);
+	}
+
+	void _reset(){
+		_value = Option_Niche<T>::empty();
+	}
+};
+
+template<typename T>
+struct Option : _Option_Storage<T> {
+	T& unwrap(caller_location) & {
+		if(!ok()){
 			panic("Attempt to unwrap empty optional", source_location);
 		}
-		return _value;
+		return this->_value;
 	}
 
-	T unwrap_unchecked() const {
-		return _value;
+	T const& unwrap(caller_location) const& {
+		if(!ok()){
+			panic("Attempt to unwrap empty optional", source_location);
+		}
+		return this->_value;
 	}
 
-	T unwrap_or(T alt) const {
-		if(!_has_value){
+	// Moves the value out of a temporary
+	T unwrap(caller_location) && {
+		if(!ok()){
+			panic("Attempt to unwrap empty optional", source_location);
+		}
+		return static_cast<T&&>(this->_value);
+	}
+
+	T& unwrap_unchecked() & { return this->_value; }
+	T const& unwrap_unchecked() const& { return this->_value; }
+	T unwrap_unchecked() && { return static_cast<T&&>(this->_value); }
+
+	T unwrap_or(T alt) const& {
+		if(!ok()){
 			return alt;
 		}
-		return _value;
+		return this->_value;
+	}
+
+	T unwrap_or(T alt) && {
+		if(!ok()){
+			return alt;
+		}
+		return static_cast<T&&>(this->_value);
 	}
 
 	bool ok() const {
-		return _has_value;
+		return this->_has();
 	}
 
 	void clear(){
-		_has_value = false;
+		this->_reset();
 	}
 
 	void operator=(T x){
-		_value = x;
-		_has_value = true;
+		this->_reset();
+		this->_emplace(static_cast<T&&>(x));
+	}
+
+	Option() = default;
+	Option(T x){ this->_emplace(static_cast<T&&>(x)); }
+};
+
+// Optional reference, stored as a single pointer
+template<typename T>
+struct Option<T&> {
+	T* _ptr = nullptr;
+
+	T& unwrap(caller_location) const {
+		if(_ptr == nullptr){
+			panic("Attempt to unwrap empty optional", source_location);
+		}
+		return *_ptr;
+	}
+
+	T& unwrap_unchecked() const {
+		return *_ptr;
+	}
+
+	T& unwrap_or(T& alt) const {
+		return _ptr ? *_ptr : alt;
+	}
+
+	bool ok() const {
+		return _ptr != nullptr;
+	}
+
+	void clear(){
+		_ptr = nullptr;
 	}
 
-	Option() : _has_value{false} {}
-	Option(T x) : _value{x}, _has_value{true} {}
+	void operator=(T& x){
+		_ptr = &x;
+	}
+
+	Option() = default;
+	Option(T& x) : _ptr{&x} {}
 };
 
+static_assert(sizeof(Option<void*>) == sizeof(void*), "Pointer options must be niche packed");
+static_assert(sizeof(Option<int&>) == sizeof(int*), "Reference options must be niche packed");
+
 /* ---------------- Result type ---------------- */
 template<typename T, typename E>
 struct Result {
@@ -344,25 +635,73 @@ private:
 	};
 	bool _has_value = false;
 
+	static constexpr bool _trivial_copy = std::is_trivially_copyable_v<T> && std::is_trivially_copyable_v<E>;
+	static constexpr bool _trivial_destroy = std::is_trivially_destructible_v<T> && std::is_trivially_destructible_v<E>;
+
+	void _destroy(){
+		if constexpr(!_trivial_destroy){
+			if(_has_value){ _value.~T(); } else { _error.~E(); }
+		}
+	}
+
+	template<typename R>
+	void _construct_from(R&& other){
+		_has_value = other._has_value;
+		if(_has_value){
+			new (&_value) T(static_cast<R&&>(other)._value);
+		} else {
+			new (&_error) E(static_cast<R&&>(other)._error);
+		}
+	}
+
 public:
-	T unwrap(caller_location) const {
+	T& unwrap(caller_location) & {
 		if(!_has_value){
 			panic("Cannot unwrap error value", source_location);
 		}
 		return _value;
 	}
 
-	T unwrap_or(T alt) const {
+	T const& unwrap(caller_location) const& {
 		if(!_has_value){
-			return alt;
+			panic("Cannot unwrap error value", source_location);
 		}
 		return _value;
 	}
 
-	T unwrap_unchecked() const {
+	// Moves the value out of a temporary
+	T unwrap(caller_location) && {
+		if(!_has_value){
+			panic("Cannot unwrap error value", source_location);
+		}
+		return static_cast<T&&>(_value);
+	}
+
+	T unwrap_or(T alt) const& {
+		if(!_has_value){
+			return alt;
+		}
 		return _value;
 	}
 
+	T unwrap_or(T alt) && {
+		if(!_has_value){
+			return alt;
+		}
+		return static_cast<T&&>(_value);
+	}
+
+	T& unwrap_unchecked() & { return _value; }
+	T const& unwrap_unchecked() const& { return _value; }
+	T unwrap_unchecked() && { return static_cast<T&&>(_value); }
+
+	E unwrap_err(caller_location) const {
+		if(_has_value){
+			panic("Cannot unwrap error of ok value", source_location);
+		}
+		return _error;
+	}
+
 	E unwrap_err_unchecked() const {
 		return _error;
 	}
@@ -372,18 +711,47 @@ public:
 	}
 
 	void operator=(T x){
-		_value = x;
+		_destroy();
+		new (&_value) T(static_cast<T&&>(x));
 		_has_value = true;
 	}
 
 	void operator=(E x){
-		_error = x;
+		_destroy();
+		new (&_error) E(static_cast<E&&>(x));
 		_has_value = false;
 	}
 
-	Result() : _error{0}, _has_value{false} {}
-	Result(T x) : _value{x}, _has_value{true} {}
-	Result(E x) : _error{x}, _has_value{false} {}
+	Result() : _error{}, _has_value{false} {}
+	Result(T x) : _value(static_cast<T&&>(x)), _has_value{true} {}
+	Result(E x) : _error(static_cast<E&&>(x)), _has_value{false} {}
+
+	Result(Result const&) requires _trivial_copy = default;
+	Result(Result const& other){ _construct_from(other); }
+
+	Result(Result&&) requires _trivial_copy = default;
+	Result(Result&& other){ _construct_from(static_cast<Result&&>(other)); }
+
+	Result& operator=(Result const&) requires _trivial_copy = default;
+	Result& operator=(Result const& other){
+		if(this != &other){
+			_destroy();
+			_construct_from(other);
+		}
+		return *this;
+	}
+
+	Result& operator=(Result&&) requires _trivial_copy = default;
+	Result& operator=(Result&& other){
+		if(this != &other){
+			_destroy();
+			_construct_from(static_cast<Result&&>(other));
+		}
+		return *this;
+	}
+
+	~Result() requires _trivial_destroy = default;
+	~Result(){ _destroy(); }
 };
 
 /* ---------------- Memory ---------------- */
@@ -510,6 +878,39 @@ struct Indexed_Contigous_Memory_Iterator {
 }
 
 /* ---------------- Vector support ----------------*/
+// Operators below are generated by arraygen.py. Outside of constant evaluation,
+// a vec<T, N> that fits a native vector register (2+ lanes, power of two size
+// between 8 bytes and the widest vector the target has) is lowered to GCC/Clang
+// vector extensions. The ISA is picked at compile time from the target flags:
+// vec<f32, 4>, vec<i32, 4> and vec<u8, 16> need only SSE2/NEON, vec<f32, 8>,
+// vec<i32, 8> and vec<u8, 32> need -mavx2 (or -march=native). Everything else
+// falls back to the generic element-wise loops.
+namespace _vec_native {
+#if defined(__clang__) || defined(__GNUC__)
+#if defined(__AVX512F__)
+constexpr inline isize max_width = 64;
+#elif defined(__AVX__)
+constexpr inline isize max_width = 32;
+#else
+constexpr inline isize max_width = 16;
+#endif
+
+template<typename T, int N>
+constexpr inline bool supported = std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && sizeof(T) <= 8 && N >= 2
+	&& mem::valid_alignment(sizeof(T) * N) && isize(sizeof(T) * N) >= 8 && isize(sizeof(T) * N) <= max_width;
+
+template<typename T, int N>
+struct Native {
+	typedef T type __attribute__((vector_size(sizeof(T) * N)));
+};
+#else
+constexpr inline isize max_width = 16;
+
+template<typename T, int N>
+constexpr inline bool supported = false;
+#endif
+}
+
 template<typename T, int N>
 struct vec {
 	T data[N];
@@ -524,84 +925,334 @@ struct vec {
 		return acc;
 	}
 };
-template<typename T, int N> constexpr vec<T, N> operator+(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] + b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator+(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] + s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator+(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s + a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator+(vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = + a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator-(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] - b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator-(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] - s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator-(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s - a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator-(vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = - a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator*(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] * b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator*(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] * s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator*(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s * a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator/(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] / b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator/(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] / s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator/(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s / a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator%(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] % b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator%(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] % s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator%(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s % a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator&(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] & b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator&(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] & s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator&(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s & a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator|(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] | b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator|(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] | s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator|(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s | a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator^(vec<T,N> a, vec<T,N> b){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] ^ b[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator^(vec<T,N> a, T s){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] ^ s; return r; }
-template<typename T, int N> constexpr vec<T, N> operator^(T s, vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s ^ a[i]; return r; }
-template<typename T, int N> constexpr vec<T, N> operator~(vec<T,N> a){ vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = ~ a[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator&&(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] && b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator||(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] || b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator==(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] == b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator!=(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] != b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator>=(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] >= b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator<=(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] <= b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator>(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] > b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator<(vec<T,N> a, vec<T,N> b){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] < b[i]; return r; }
-template<typename T, int N> constexpr vec<bool, N> operator!(vec<T,N> a){ vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = ! a[i]; return r; }
 
-/* ---------------- Slices ---------------- */
+namespace _vec_native {
+#if defined(__clang__) || defined(__GNUC__)
+template<typename T, int N>
+static inline auto load(vec<T, N> v){
+	return bit_cast<typename Native<T, N>::type>(v);
+}
+
+template<typename T, int N, typename V>
+static inline vec<T, N> store(V v){
+	return bit_cast<vec<T, N>>(v);
+}
+
+// Comparisons produce lanes of all 1s or 0s, narrow them down to bools
+template<int N, typename M>
+static inline vec<bool, N> store_mask(M m){
+	return bit_cast<vec<bool, N>>(__builtin_convertvector(m, typename Native<i8, N>::type) & 1);
+}
+
+template<isize Size> struct Lane_Int;
+template<> struct Lane_Int<1> { using type = i8; };
+template<> struct Lane_Int<2> { using type = i16; };
+template<> struct Lane_Int<4> { using type = i32; };
+template<> struct Lane_Int<8> { using type = i64; };
+
+template<typename T, int N>
+static inline vec<T, N> select(vec<bool, N> mask, vec<T, N> a, vec<T, N> b){
+	using Lanes = typename Native<typename Lane_Int<sizeof(T)>::type, N>::type;
+	auto m = __builtin_convertvector(bit_cast<typename Native<i8, N>::type>(mask), Lanes);
+	return store<T, N>(m != 0 ? load(a) : load(b));
+}
+
+template<typename T, int N>
+static inline vec<T, N> min(vec<T, N> a, vec<T, N> b){
+	auto va = load(a), vb = load(b);
+	return store<T, N>(va < vb ? va : vb);
+}
+
+template<typename T, int N>
+static inline vec<T, N> max(vec<T, N> a, vec<T, N> b){
+	auto va = load(a), vb = load(b);
+	return store<T, N>(va > vb ? va : vb);
+}
+
+template<typename T, int N, int... I>
+static inline vec<T, sizeof...(I)> shuffle(vec<T, N> v){
+	return store<T, sizeof...(I)>(__builtin_shufflevector(load(v), load(v), I...));
+}
+#else
+template<typename T, int N> auto load(vec<T, N> v);
+template<typename T, int N, typename V> vec<T, N> store(V v);
+template<int N, typename M> vec<bool, N> store_mask(M m);
+template<typename T, int N> vec<T, N> select(vec<bool, N> mask, vec<T, N> a, vec<T, N> b);
+template<typename T, int N> vec<T, N> min(vec<T, N> a, vec<T, N> b);
+template<typename T, int N> vec<T, N> max(vec<T, N> a, vec<T, N> b);
+template<typename T, int N, int... I> vec<T, sizeof...(I)> shuffle(vec<T, N> v);
+#endif
+}
+
+template<typename T, int N> constexpr vec<T, N> operator+(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) + _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] + b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator+(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) + s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] + s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator+(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s + _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s + a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator+(vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(+ _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = + a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator-(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) - _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] - b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator-(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) - s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] - s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator-(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s - _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s - a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator-(vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(- _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = - a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator*(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) * _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] * b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator*(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) * s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] * s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator*(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s * _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s * a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator/(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) / _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] / b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator/(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) / s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] / s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator/(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s / _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s / a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator%(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) % _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] % b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator%(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) % s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] % s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator%(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s % _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s % a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator&(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) & _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] & b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator&(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) & s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] & s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator&(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s & _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s & a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator|(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) | _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] | b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator|(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) | s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] | s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator|(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s | _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s | a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator^(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) ^ _vec_native::load(b)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] ^ b[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator^(vec<T,N> a, T s){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(_vec_native::load(a) ^ s); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] ^ s; return r; }
+template<typename T, int N> constexpr vec<T, N> operator^(T s, vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(s ^ _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = s ^ a[i]; return r; }
+template<typename T, int N> constexpr vec<T, N> operator~(vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store<T, N>(~ _vec_native::load(a)); } } vec<T, N> r{}; for(int i=0;i<N;i++) r[i] = ~ a[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator&&(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>((_vec_native::load(a) != 0) & (_vec_native::load(b) != 0)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] && b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator||(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>((_vec_native::load(a) != 0) | (_vec_native::load(b) != 0)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] || b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator==(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) == _vec_native::load(b)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] == b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator!=(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) != _vec_native::load(b)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] != b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator>=(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) >= _vec_native::load(b)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] >= b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator<=(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) <= _vec_native::load(b)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] <= b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator>(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) > _vec_native::load(b)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] > b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator<(vec<T,N> a, vec<T,N> b){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) < _vec_native::load(b)); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = a[i] < b[i]; return r; }
+template<typename T, int N> constexpr vec<bool, N> operator!(vec<T,N> a){ if constexpr(_vec_native::supported<T, N>){ if(!std::is_constant_evaluated()){ return _vec_native::store_mask<N>(_vec_native::load(a) == 0); } } vec<bool, N> r{}; for(int i=0;i<N;i++) r[i] = ! a[i]; return r; }
+
+/* ---------------- Vector math ---------------- */
+#if defined(__clang__) || defined(__GNUC__)
+#define _sqrt_impl __builtin_sqrt
+#define _sqrtf_impl __builtin_sqrtf
+#else
+extern "C" double sqrt(double);
+extern "C" float sqrtf(float);
+#define _sqrt_impl sqrt
+#define _sqrtf_impl sqrtf
+#endif
+
 template<typename T>
-struct slice {
-private:
-	T* _data = nullptr;
-	isize _len = 0;
+static inline T _vec_sqrt(T x){
+	if constexpr(std::is_same_v<T, f32>){
+		return _sqrtf_impl(x);
+	}
+	else {
+		return _sqrt_impl(x);
+	}
+}
 
-public:
-	constexpr
-	auto raw_data() const { return _data; }
+#undef _sqrt_impl
+#undef _sqrtf_impl
 
-	constexpr
-	auto len() const { return _len; }
+// Lane-wise ternary, picks a[i] where mask[i] is set and b[i] otherwise
+template<typename T, int N> constexpr
+vec<T, N> select(vec<bool, N> mask, vec<T, N> a, vec<T, N> b){
+	if constexpr(_vec_native::supported<T, N>){
+		if(!std::is_constant_evaluated()){ return _vec_native::select(mask, a, b); }
+	}
+	vec<T, N> r{};
+	for(int i = 0; i < N; i++) r[i] = mask[i] ? a[i] : b[i];
+	return r;
+}
 
-	constexpr
-	T& operator[](isize idx){
-		bounds_check(idx >= 0 && idx < _len, "Out of bounds access to slice");
-		return _data[idx];
+template<int N> constexpr
+bool any(vec<bool, N> mask){
+	if constexpr(N % 8 == 0){
+		if(!std::is_constant_evaluated()){
+			auto words = bit_cast<vec<u64, N / 8>>(mask);
+			u64 acc = 0;
+			for(int i = 0; i < N / 8; i++) acc |= words[i];
+			return acc != 0;
+		}
+	}
+	for(int i = 0; i < N; i++){
+		if(mask[i]){ return true; }
 	}
+	return false;
+}
 
-	constexpr
-	T const& operator[](isize idx) const{
-		bounds_check(idx >= 0 && idx < _len, "Out of bounds access to slice");
-		return _data[idx];
+template<int N> constexpr
+bool all(vec<bool, N> mask){
+	if constexpr(N % 8 == 0){
+		if(!std::is_constant_evaluated()){
+			auto words = bit_cast<vec<u64, N / 8>>(mask);
+			u64 acc = ~u64(0);
+			for(int i = 0; i < N / 8; i++) acc &= words[i];
+			return acc == 0x0101010101010101ull;
+		}
 	}
+	for(int i = 0; i < N; i++){
+		if(!mask[i]){ return false; }
+	}
+	return true;
+}
 
-	constexpr
-	slice<T> sub(isize start, isize n){
-		if(start < 0 || n < 0 || (start + n) > _len){ return {}; }
-		return from(&_data[start], n);
+template<typename T, int N> constexpr
+vec<T, N> min(vec<T, N> a, vec<T, N> b){
+	if constexpr(_vec_native::supported<T, N>){
+		if(!std::is_constant_evaluated()){ return _vec_native::min(a, b); }
 	}
+	vec<T, N> r{};
+	for(int i = 0; i < N; i++) r[i] = min(a[i], b[i]);
+	return r;
+}
 
-	constexpr
-	static slice from(T* ptr, isize len){
-		slice s;
-		s._data = ptr;
-		s._len = max(isize(0), len);
-		return s;
+template<typename T, int N> constexpr
+vec<T, N> max(vec<T, N> a, vec<T, N> b){
+	if constexpr(_vec_native::supported<T, N>){
+		if(!std::is_constant_evaluated()){ return _vec_native::max(a, b); }
 	}
+	vec<T, N> r{};
+	for(int i = 0; i < N; i++) r[i] = max(a[i], b[i]);
+	return r;
+}
 
-	/* C++ Iterator Insanity */
+template<typename T, int N> constexpr
+vec<T, N> clamp(vec<T, N> lo, vec<T, N> x, vec<T, N> hi){
+	return min(max(lo, x), hi);
+}
+
+// Computes a * b + c, fused into a single instruction on targets with FMA
+template<typename T, int N> constexpr
+vec<T, N> fma(vec<T, N> a, vec<T, N> b, vec<T, N> c){
+#if defined(__FMA__)
+	if(!std::is_constant_evaluated()){
+		if constexpr(std::is_same_v<T, f32> && N == 4){
+			return bit_cast<vec<T, N>>(_mm_fmadd_ps(bit_cast<__m128>(a), bit_cast<__m128>(b), bit_cast<__m128>(c)));
+		}
+		if constexpr(std::is_same_v<T, f64> && N == 2){
+			return bit_cast<vec<T, N>>(_mm_fmadd_pd(bit_cast<__m128d>(a), bit_cast<__m128d>(b), bit_cast<__m128d>(c)));
+		}
+		if constexpr(std::is_same_v<T, f32> && N == 8){
+			return bit_cast<vec<T, N>>(_mm256_fmadd_ps(bit_cast<__m256>(a), bit_cast<__m256>(b), bit_cast<__m256>(c)));
+		}
+		if constexpr(std::is_same_v<T, f64> && N == 4){
+			return bit_cast<vec<T, N>>(_mm256_fmadd_pd(bit_cast<__m256d>(a), bit_cast<__m256d>(b), bit_cast<__m256d>(c)));
+		}
+	}
+#endif
+	return a * b + c;
+}
+
+// Reduce lanes with `f` by folding the upper half onto the lower half, so
+// native vectors take log2(N) vector operations instead of N scalar ones.
+template<typename T, int N, typename F> constexpr
+T _vec_reduce(vec<T, N> v, F f){
+	if constexpr(N > 1 && N % 2 == 0){
+		auto halves = bit_cast<vec<vec<T, N / 2>, 2>>(v);
+		return _vec_reduce(f(halves[0], halves[1]), f);
+	}
+	else {
+		T acc = v[0];
+		for(int i = 1; i < N; i++) acc = f(acc, v[i]);
+		return acc;
+	}
+}
+
+template<typename T, int N> constexpr
+T hsum(vec<T, N> v){
+	return _vec_reduce(v, [](auto a, auto b){ return a + b; });
+}
+
+template<typename T, int N> constexpr
+T product(vec<T, N> v){
+	return _vec_reduce(v, [](auto a, auto b){ return a * b; });
+}
+
+template<typename T, int N> constexpr
+T hmin(vec<T, N> v){
+	return _vec_reduce(v, [](auto a, auto b){ return min(a, b); });
+}
+
+template<typename T, int N> constexpr
+T hmax(vec<T, N> v){
+	return _vec_reduce(v, [](auto a, auto b){ return max(a, b); });
+}
+
+template<typename T, int N> constexpr
+T dot(vec<T, N> a, vec<T, N> b){
+	return hsum(a * b);
+}
+
+template<typename T> constexpr
+vec<T, 3> cross(vec<T, 3> a, vec<T, 3> b){
+	return {{
+		a[1] * b[2] - a[2] * b[1],
+		a[2] * b[0] - a[0] * b[2],
+		a[0] * b[1] - a[1] * b[0],
+	}};
+}
+
+template<typename T, int N>
+T length(vec<T, N> v){
+	static_assert(std::is_floating_point_v<T>, "length() requires a floating point vec");
+	return _vec_sqrt(dot(v, v));
+}
+
+// Returns v scaled to unit length, a zero vector stays zero
+template<typename T, int N>
+vec<T, N> normalize(vec<T, N> v){
+	T len = length(v);
+	if(len == T(0)){ return v; }
+	return v * (T(1) / len);
+}
+
+// Build a vec from arbitrary lanes of `v`, e.g. swizzle<2, 1, 0>(rgb) gives bgr
+template<int... I, typename T, int N> constexpr
+vec<T, sizeof...(I)> swizzle(vec<T, N> v){
+	static_assert(((I >= 0 && I < N) && ...), "Swizzle index out of range");
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_shufflevector)
+	if constexpr(_vec_native::supported<T, N> && _vec_native::supported<T, sizeof...(I)>){
+		if(!std::is_constant_evaluated()){ return _vec_native::shuffle<T, N, I...>(v); }
+	}
+#endif
+#endif
+	return {{ v[I]... }};
+}
+
+/* ---------------- Slices ---------------- */
+template<typename T>
+struct slice {
+private:
+	T* _data = nullptr;
+	isize _len = 0;
+
+public:
+	constexpr
+	auto raw_data() const { return _data; }
+
+	constexpr
+	auto len() const { return _len; }
+
+	constexpr
+	T& operator[](isize idx){
+		bounds_check(idx >= 0 && idx < _len, "Out of bounds access to slice");
+		return _data[idx];
+	}
+
+	constexpr
+	T const& operator[](isize idx) const{
+		bounds_check(idx >= 0 && idx < _len, "Out of bounds access to slice");
+		return _data[idx];
+	}
+
+	constexpr
+	slice<T> sub(isize start, isize n){
+		if(start < 0 || n < 0 || (start + n) > _len){ return {}; }
+		return from(&_data[start], n);
+	}
+
+	constexpr
+	static slice from(T* ptr, isize len){
+		slice s;
+		s._data = ptr;
+		s._len = max(isize(0), len);
+		return s;
+	}
+
+	/* C++ Iterator Insanity */
 	constexpr auto begin(){ return cpp_iter::Contigous_Memory_Iterator<T>(&_data[0]); }
 	constexpr auto end(){ return cpp_iter::Contigous_Memory_Iterator<T>(&_data[_len]); }
 	class Slice_Index_Iterator {
@@ -812,6 +1463,7 @@ isize cstring_len(cstring cstr){
 
 struct string {
 private:
+	friend struct Option_Niche<string>;
 	isize _len = 0;
 	union {
 		byte const * _data = nullptr;
@@ -983,12 +1635,22 @@ public:
 		return s;
 	}
 
-	bool operator==(string rhs) {
+	// Byte-wise lexicographic order
+	bool operator<(string rhs) const {
+		isize n = min(_len, rhs._len);
+		if(n > 0){
+			i32 c = mem::compare(_data, rhs._data, n);
+			if(c != 0){ return c < 0; }
+		}
+		return _len < rhs._len;
+	}
+
+	bool operator==(string rhs) const {
 		if(_len != rhs._len){ return false; }
 		return mem::compare(_data, rhs._data, _len) == 0;
 	}
 
-	bool operator!=(string rhs) {
+	bool operator!=(string rhs) const {
 		if(_len != rhs._len){ return true; }
 		return mem::compare(_data, rhs._data, _len) != 0;
 	}
@@ -997,8 +1659,271 @@ public:
 	constexpr string(cstring cs) : _len(cstring_len(cs)), _cdata(cs) {}
 };
 
+// Empty Option<string> is marked by a negative length
+template<>
+struct Option_Niche<string> {
+	static constexpr bool enabled = true;
+	static constexpr string empty(){
+		string s;
+		s._len = -1;
+		return s;
+	}
+	static constexpr bool is_empty(string const& s){ return s._len < 0; }
+};
+
+static_assert(sizeof(Option<string>) == sizeof(string), "String options must be niche packed");
+
 #undef MAX_CUTSET_LEN
 
+/* ---------------- UTF-8 Bulk Transcoding ---------------- */
+// Bulk conversion between UTF-8, UTF-32 (runes) and UTF-16. Output is always
+// written to a caller provided slice, nothing is allocated. Runs of ASCII are
+// converted a block at a time, everything else goes through a strict decoder
+// (rejects overlong forms, surrogates and codepoints past RANGE4).
+//
+// Worst case output sizes:
+//   UTF-8 -> runes / UTF-16: 1 unit per input byte
+//   runes -> UTF-8: 4 bytes per rune
+//   UTF-16 -> UTF-8: 3 bytes per unit
+namespace utf8 {
+enum struct Transcode_Error : u8 {
+	none = 0,
+	invalid_input,
+	output_too_small,
+};
+
+// On error, `read` is the offset of the offending input unit (or of the first
+// unit that did not fit in the output).
+struct Transcode_Result {
+	isize read;
+	isize written;
+	Transcode_Error error;
+};
+
+constexpr inline isize ASCII_BLOCK = 16;
+
+static inline
+bool _is_ascii_block(byte const* p){
+	u64 words[2];
+	mem::copy_no_overlap(words, p, sizeof(words));
+	return ((words[0] | words[1]) & 0x8080808080808080ull) == 0;
+}
+
+static inline
+Decode_Result _decode_strict(byte const* buf, isize len){
+	constexpr rune min_codepoint[5] = {0, 0, 0x80, 0x800, 0x10000};
+	auto res = utf8_decode(buf, len);
+	if(res.len == 0 || res.codepoint < min_codepoint[res.len] || res.codepoint > RANGE4){
+		return DECODE_ERROR;
+	}
+	return res;
+}
+
+// Writes the UTF-8 encoding of a valid codepoint, returns number of bytes written
+static inline
+isize _encode_unchecked(byte* dst, rune c){
+	if(c <= RANGE1){
+		dst[0] = c;
+		return 1;
+	}
+	if(c <= RANGE2){
+		dst[0] = SIZE2 | ((c >> 6) & MASK2);
+		dst[1] = CONT  | ((c >> 0) & MASKX);
+		return 2;
+	}
+	if(c <= RANGE3){
+		dst[0] = SIZE3 | ((c >> 12) & MASK3);
+		dst[1] = CONT  | ((c >> 6) & MASKX);
+		dst[2] = CONT  | ((c >> 0) & MASKX);
+		return 3;
+	}
+	dst[0] = SIZE4 | ((c >> 18) & MASK4);
+	dst[1] = CONT  | ((c >> 12) & MASKX);
+	dst[2] = CONT  | ((c >> 6)  & MASKX);
+	dst[3] = CONT  | ((c >> 0)  & MASKX);
+	return 4;
+}
+
+static inline
+isize _encoded_len(rune c){
+	if(c <= RANGE1){ return 1; }
+	if(c <= RANGE2){ return 2; }
+	if(c <= RANGE3){ return 3; }
+	return 4;
+}
+
+static inline
+bool _is_valid_rune(rune c){
+	return c >= 0 && c <= RANGE4 && !(c >= SURROGATE1 && c <= SURROGATE2);
+}
+
+// Decode UTF-8 into runes
+static inline
+Transcode_Result decode_into(slice<rune> out, string in){
+	byte const* src = in.raw_data();
+	rune* dst = out.raw_data();
+	isize src_len = in.len();
+	isize dst_len = out.len();
+	isize i = 0, j = 0;
+
+	while(i < src_len){
+		if((src_len - i) >= ASCII_BLOCK && (dst_len - j) >= ASCII_BLOCK && _is_ascii_block(&src[i])){
+			for(isize k = 0; k < ASCII_BLOCK; k += 1){
+				dst[j + k] = src[i + k];
+			}
+			i += ASCII_BLOCK;
+			j += ASCII_BLOCK;
+			continue;
+		}
+
+		if(j >= dst_len){
+			return {i, j, Transcode_Error::output_too_small};
+		}
+
+		auto [c, n] = _decode_strict(&src[i], src_len - i);
+		if(n == 0){
+			return {i, j, Transcode_Error::invalid_input};
+		}
+		dst[j] = c;
+		i += n;
+		j += 1;
+	}
+
+	return {i, j, Transcode_Error::none};
+}
+
+// Encode runes into UTF-8
+static inline
+Transcode_Result encode_from(slice<byte> out, slice<rune> in){
+	rune const* src = in.raw_data();
+	byte* dst = out.raw_data();
+	isize src_len = in.len();
+	isize dst_len = out.len();
+	isize i = 0, j = 0;
+
+	while(i < src_len){
+		if((src_len - i) >= ASCII_BLOCK && (dst_len - j) >= ASCII_BLOCK){
+			u32 acc = 0;
+			for(isize k = 0; k < ASCII_BLOCK; k += 1){
+				acc |= u32(src[i + k]);
+			}
+			if(acc <= u32(RANGE1)){
+				for(isize k = 0; k < ASCII_BLOCK; k += 1){
+					dst[j + k] = byte(src[i + k]);
+				}
+				i += ASCII_BLOCK;
+				j += ASCII_BLOCK;
+				continue;
+			}
+		}
+
+		rune c = src[i];
+		if(!_is_valid_rune(c)){
+			return {i, j, Transcode_Error::invalid_input};
+		}
+		if((dst_len - j) < _encoded_len(c)){
+			return {i, j, Transcode_Error::output_too_small};
+		}
+		j += _encode_unchecked(&dst[j], c);
+		i += 1;
+	}
+
+	return {i, j, Transcode_Error::none};
+}
+
+// Transcode UTF-8 into UTF-16 (native endianness)
+static inline
+Transcode_Result to_utf16(slice<u16> out, string in){
+	byte const* src = in.raw_data();
+	u16* dst = out.raw_data();
+	isize src_len = in.len();
+	isize dst_len = out.len();
+	isize i = 0, j = 0;
+
+	while(i < src_len){
+		if((src_len - i) >= ASCII_BLOCK && (dst_len - j) >= ASCII_BLOCK && _is_ascii_block(&src[i])){
+			for(isize k = 0; k < ASCII_BLOCK; k += 1){
+				dst[j + k] = src[i + k];
+			}
+			i += ASCII_BLOCK;
+			j += ASCII_BLOCK;
+			continue;
+		}
+
+		auto [c, n] = _decode_strict(&src[i], src_len - i);
+		if(n == 0){
+			return {i, j, Transcode_Error::invalid_input};
+		}
+
+		if(c <= RANGE3){
+			if(j >= dst_len){
+				return {i, j, Transcode_Error::output_too_small};
+			}
+			dst[j] = u16(c);
+			j += 1;
+		}
+		else {
+			if((dst_len - j) < 2){
+				return {i, j, Transcode_Error::output_too_small};
+			}
+			rune v = c - 0x10000;
+			dst[j + 0] = u16(SURROGATE1 + (v >> 10));
+			dst[j + 1] = u16(0xdc00 + (v & 0x3ff));
+			j += 2;
+		}
+		i += n;
+	}
+
+	return {i, j, Transcode_Error::none};
+}
+
+// Transcode UTF-16 (native endianness) into UTF-8
+static inline
+Transcode_Result from_utf16(slice<byte> out, slice<u16> in){
+	u16 const* src = in.raw_data();
+	byte* dst = out.raw_data();
+	isize src_len = in.len();
+	isize dst_len = out.len();
+	isize i = 0, j = 0;
+
+	while(i < src_len){
+		if((src_len - i) >= ASCII_BLOCK && (dst_len - j) >= ASCII_BLOCK){
+			u16 acc = 0;
+			for(isize k = 0; k < ASCII_BLOCK; k += 1){
+				acc |= src[i + k];
+			}
+			if(acc <= RANGE1){
+				for(isize k = 0; k < ASCII_BLOCK; k += 1){
+					dst[j + k] = byte(src[i + k]);
+				}
+				i += ASCII_BLOCK;
+				j += ASCII_BLOCK;
+				continue;
+			}
+		}
+
+		rune c = src[i];
+		isize n = 1;
+		if(c >= SURROGATE1 && c <= SURROGATE2){
+			rune lo = (i + 1) < src_len ? src[i + 1] : 0;
+			if(c >= 0xdc00 || lo < 0xdc00 || lo > SURROGATE2){
+				return {i, j, Transcode_Error::invalid_input};
+			}
+			c = 0x10000 + ((c - SURROGATE1) << 10) + (lo - 0xdc00);
+			n = 2;
+		}
+
+		if((dst_len - j) < _encoded_len(c)){
+			return {i, j, Transcode_Error::output_too_small};
+		}
+		j += _encode_unchecked(&dst[j], c);
+		i += n;
+	}
+
+	return {i, j, Transcode_Error::none};
+}
+}
+
 /* ---------------- Spinlock ---------------- */
 namespace atomic {
 struct Spinlock {
@@ -1027,6 +1952,38 @@ struct Spinlock {
 };
 }
 
+/* ---------------- Cache Padding ---------------- */
+namespace atomic {
+// Minimum distance between two objects written by different threads to avoid
+// false sharing. GCC warns on any use of the standard constant in a header, as
+// its value may differ between -mtune targets.
+#if defined(__cpp_lib_hardware_interference_size)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+constexpr inline isize cache_line_size = std::hardware_destructive_interference_size;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+constexpr inline isize cache_line_size = 64;
+#endif
+
+// Places `value` alone in its cache line(s), so writes to it don't invalidate
+// neighbouring data read or written by other threads
+template<typename T>
+struct alignas(cache_line_size) Cache_Padded {
+	T value;
+
+	T* operator->(){ return &value; }
+	T const* operator->() const { return &value; }
+	T& operator*(){ return value; }
+	T const& operator*() const { return value; }
+};
+static_assert(sizeof(Cache_Padded<u8>) == cache_line_size, "Padded size must be a whole cache line");
+}
+
 /* ---------------- Allocator Interface ---------------- */
 namespace mem {
 enum struct Allocator_Mode : u8 {
@@ -1040,10 +1997,12 @@ constexpr inline u32 can_free_any_order  = 1 << 2;
 constexpr inline u32 can_resize          = 1 << 3;
 constexpr inline u32 can_free_all        = 1 << 4;
 
-// Allocator_Error's are meant to be thrown, that is, they are exceptional
-// conditions. Failing to resize an allocation or not supporting `free_all`
-// should be communicated through the return address or by querying the
-// allocator's capabilities.
+// Allocator_Error's are exceptional conditions. Failing to resize an
+// allocation or not supporting `free_all` should be communicated through the
+// return address or by querying the allocator's capabilities. Allocator
+// functions never throw: they record the error with _alloc_failed() and
+// return null, Allocator::alloc() then throws it unless DISABLE_EXCEPTIONS is
+// defined. Allocator::try_alloc() never throws.
 enum struct Allocator_Error : u8 {
 	none = 0,
 	out_of_memory,
@@ -1051,6 +2010,23 @@ enum struct Allocator_Error : u8 {
 	pointer_not_owned, /* Mostly used by tracking allocators, it's usually not worth throwing it in release builds */
 };
 
+inline thread_local Allocator_Error _last_error = Allocator_Error::none;
+
+// Record an allocation failure, for use by allocator functions
+static inline
+void* _alloc_failed(Allocator_Error err){
+	_last_error = err;
+	return nullptr;
+}
+
+// Error of the last failed allocation on this thread, clears it
+static inline
+Allocator_Error last_error(){
+	Allocator_Error err = _last_error;
+	_last_error = Allocator_Error::none;
+	return err == Allocator_Error::none ? Allocator_Error::out_of_memory : err;
+}
+
 // Allocator function, returns a error value
 using Allocator_Func = void* (*)(
     void *impl, Allocator_Mode mode, void *ptr, isize old_size, isize size,
@@ -1065,14 +2041,29 @@ struct Allocator {
 
 	// Allocate chunk of aligned memory (zero-initialized)
 	[[nodiscard]]
-	auto alloc(isize size, isize align, caller_location){
-		return _func(_impl, Mode::alloc, nullptr, 0, size, align, source_location);
+	void* alloc(isize size, isize align, caller_location){
+		return _checked(_func(_impl, Mode::alloc, nullptr, 0, size, align, source_location));
 	}
 
 	// Allocate chunk of aligned memory (not initialized)
 	[[nodiscard]]
-	auto alloc_non_zero(isize size, isize align, caller_location){
-		return _func(_impl, Mode::alloc_non_zero, nullptr, 0, size, align, source_location);
+	void* alloc_non_zero(isize size, isize align, caller_location){
+		return _checked(_func(_impl, Mode::alloc_non_zero, nullptr, 0, size, align, source_location));
+	}
+
+	// Like alloc(), but reports failure as a value even when exceptions are enabled
+	[[nodiscard]]
+	Result<void*, Allocator_Error> try_alloc(isize size, isize align, caller_location){
+		void* p = _func(_impl, Mode::alloc, nullptr, 0, size, align, source_location);
+		if(p == nullptr){ return last_error(); }
+		return p;
+	}
+
+	[[nodiscard]]
+	Result<void*, Allocator_Error> try_alloc_non_zero(isize size, isize align, caller_location){
+		void* p = _func(_impl, Mode::alloc_non_zero, nullptr, 0, size, align, source_location);
+		if(p == nullptr){ return last_error(); }
+		return p;
 	}
 
 	// Mark pointer that belongs to allocator as free
@@ -1123,6 +2114,13 @@ struct Allocator {
 		Allocator a {impl, func};
 		return a;
 	}
+
+	static void* _checked(void* p){
+#ifndef DISABLE_EXCEPTIONS
+		if(p == nullptr){ throw last_error(); }
+#endif
+		return p;
+	}
 };
 }
 
@@ -1134,10 +2132,8 @@ struct Arena {
 	isize cap = 0;
 	void* last_allocation = nullptr;
 
+	// Bytes needed to place `nbytes` at `cur` aligned to `align` (must be valid)
 	uintptr required_mem(uintptr cur, isize nbytes, isize align) const {
-		if(!mem::valid_alignment(align)){
-			throw Allocator_Error::bad_align;
-		}
 		uintptr aligned  = mem::align_forward<uintptr>(cur, align);
 		uintptr padding  = (uintptr)(aligned - cur);
 		uintptr required = padding + nbytes;
@@ -1145,6 +2141,9 @@ struct Arena {
 	}
 
 	void* alloc_non_zero(isize size, isize align){
+		if(!mem::valid_alignment(align)){
+			return nullptr;
+		}
 		uintptr base = (uintptr)data;
 		uintptr current = (uintptr)base + (uintptr)offset;
 
@@ -1226,18 +2225,14 @@ static inline void* _arena_allocator_func(
 		return (void*)(uintptr)capabilities;
 	} break;
 
-	case Allocator_Mode::alloc_non_zero: {
-		void* p = arena->alloc_non_zero(size, align);
-		if(!p){
-			throw Allocator_Error::out_of_memory;
-		}
-		return p;
-	} break;
-
+	case Allocator_Mode::alloc_non_zero:
 	case Allocator_Mode::alloc: {
-		void* p = arena->alloc(size, align);
+		if(!mem::valid_alignment(align)){
+			return _alloc_failed(Allocator_Error::bad_align);
+		}
+		void* p = mode == Allocator_Mode::alloc ? arena->alloc(size, align) : arena->alloc_non_zero(size, align);
 		if(!p){
-			throw Allocator_Error::out_of_memory;
+			return _alloc_failed(Allocator_Error::out_of_memory);
 		}
 		return p;
 	} break;
@@ -1272,8 +2267,11 @@ inline Allocator Arena::allocator(){
 
 /* --------------- Null Allocator --------------- */
 namespace mem {
-static inline void* _null_allocator_func(void *, Allocator_Mode, void *, isize, isize, isize, Source_Location const&){
-	throw Allocator_Error::out_of_memory;
+static inline void* _null_allocator_func(void *, Allocator_Mode mode, void *, isize, isize, isize, Source_Location const&){
+	if(mode == Allocator_Mode::alloc || mode == Allocator_Mode::alloc_non_zero){
+		return _alloc_failed(Allocator_Error::out_of_memory);
+	}
+	return nullptr;
 }
 
 static inline Allocator null_allocator(){
@@ -1283,6 +2281,8 @@ static inline Allocator null_allocator(){
 
 /* ---------------- Heap Allocator ---------------- */
 namespace mem {
+// Uses the C aligned allocation functions, so memory can be released without
+// knowing the alignment it was requested with.
 static inline void* _heap_allocator_func(
 	[[maybe_unused]] void *impl,
 	Allocator_Mode mode,
@@ -1292,40 +2292,40 @@ static inline void* _heap_allocator_func(
 	isize align,
 	[[maybe_unused]] caller_location
 ){
-	try {
-		switch (mode) {
-		case Allocator_Mode::query: {
-			u32 capabilities = can_alloc_any_size | can_alloc_any_align | can_free_any_order;
-			return (void*)(uintptr)capabilities;
-		} break;
-
-		case Allocator_Mode::alloc_non_zero: {
-			byte* p = new (std::align_val_t(align)) byte[size];
-			return (void*) p;
-		} break;
+	switch (mode) {
+	case Allocator_Mode::query: {
+		u32 capabilities = can_alloc_any_size | can_alloc_any_align | can_free_any_order;
+		return (void*)(uintptr)capabilities;
+	} break;
 
-		case Allocator_Mode::alloc: {
-			byte* p = new (std::align_val_t(align)) byte[size];
-			if(p){
-				mem::set(p, 0, size);
-			}
-			return (void*) p;
-		} break;
+	case Allocator_Mode::alloc_non_zero:
+	case Allocator_Mode::alloc: {
+		if(!mem::valid_alignment(align)){
+			return _alloc_failed(Allocator_Error::bad_align);
+		}
+		align = max(align, isize(alignof(max_align_t)));
+		isize alloc_size = mem::align_forward<isize>(max(size, isize(1)), align);
 
-		case Allocator_Mode::resize: {
-			return nullptr;
+		void* p = aligned_alloc(align, alloc_size);
+		if(!p){
+			return _alloc_failed(Allocator_Error::out_of_memory);
 		}
+		if(mode == Allocator_Mode::alloc){
+			mem::set(p, 0, size);
+		}
+		return p;
+	} break;
 
-		case Allocator_Mode::free: {
-			delete [] (byte*)ptr;
-		} break;
+	case Allocator_Mode::resize: {
+		return nullptr;
+	}
 
-		case Allocator_Mode::free_all:
-			return nullptr;
-		}
+	case Allocator_Mode::free: {
+		::free(ptr);
+	} break;
 
-	} catch(std::bad_alloc const&){
-		throw Allocator_Error::out_of_memory;
+	case Allocator_Mode::free_all:
+		return nullptr;
 	}
 
 	return nullptr;
@@ -1336,71 +2336,241 @@ static inline Allocator heap_allocator(){
 }
 }
 
-/* ---------------- Dynamic Array ---------------- */
-template<typename T>
-struct Dynamic_Array {
-	T* data = nullptr;
-	isize length = 0;
-	isize capacity = 0;
-	mem::Allocator allocator;
+/* ---------------- Pool Allocator ---------------- */
+namespace mem {
+// Fixed size block allocator. Blocks are carved from chunks requested from a
+// backing allocator and recycled through an intrusive free list, so alloc and
+// free are O(1) and only touch the backing allocator when a chunk runs out.
+struct Pool {
+	struct Free_Block {
+		Free_Block* next;
+	};
 
-	auto len() const { return length; }
+	struct Chunk_Header {
+		Chunk_Header* next;
+		isize size;
+	};
 
-	auto cap() const { return capacity; }
+	Allocator backing;
+	isize block_size = 0;
+	isize block_align = 0;
+	isize blocks_per_chunk = 0;
+	Free_Block* free_list = nullptr;
+	Chunk_Header* chunks = nullptr;
 
-	void resize(isize new_cap){
-		isize new_size = new_cap * sizeof(T);
-		isize old_size = length * sizeof(T);
+	isize _header_size() const {
+		return mem::align_forward<isize>(sizeof(Chunk_Header), block_align);
+	}
+
+	bool _add_chunk(){
+		isize header = _header_size();
+		isize size = header + block_size * blocks_per_chunk;
+		auto chunk = (Chunk_Header*)backing.alloc_non_zero(size, block_align);
+		if(chunk == nullptr){ return false; }
+		chunk->next = chunks;
+		chunk->size = size;
+		chunks = chunk;
+
+		byte* blocks = (byte*)chunk + header;
+		for(isize i = blocks_per_chunk - 1; i >= 0; i--){
+			auto b = (Free_Block*)&blocks[i * block_size];
+			b->next = free_list;
+			free_list = b;
+		}
+		return true;
+	}
+
+	// Uninitialized block, null if the backing allocator failed
+	void* alloc(){
+		if(free_list == nullptr && !_add_chunk()){
+			return nullptr;
+		}
+		Free_Block* b = free_list;
+		free_list = b->next;
+		return b;
+	}
+
+	void free(void* p){
+		if(p == nullptr){ return; }
+		auto b = (Free_Block*)p;
+		b->next = free_list;
+		free_list = b;
+	}
+
+	// Return every chunk to the backing allocator
+	void free_all(){
+		while(chunks){
+			Chunk_Header* next = chunks->next;
+			backing.free(chunks, chunks->size);
+			chunks = next;
+		}
+		free_list = nullptr;
+	}
+
+	// Make sure at least `count` blocks can be handed out without touching the backing allocator
+	bool reserve(isize count){
+		isize available = 0;
+		for(Free_Block* b = free_list; b && available < count; b = b->next){
+			available += 1;
+		}
+		while(available < count){
+			if(!_add_chunk()){ return false; }
+			available += blocks_per_chunk;
+		}
+		return true;
+	}
+
+	static Pool from(Allocator backing, isize block_size, isize block_align, isize blocks_per_chunk = 64){
+		Pool p;
+		p.backing = backing;
+		p.block_align = max(block_align, isize(alignof(Free_Block)));
+		p.block_size = mem::align_forward<isize>(max(block_size, isize(sizeof(Free_Block))), p.block_align);
+		p.blocks_per_chunk = max(blocks_per_chunk, isize(1));
+		return p;
+	}
+
+	void destroy(){
+		free_all();
+	}
+
+	Allocator allocator(); /* Defined below */
+};
+
+static inline void* _pool_allocator_func(
+	void *impl,
+	Allocator_Mode mode,
+	void *ptr,
+	[[maybe_unused]] isize old_size,
+	isize size,
+	isize align,
+	[[maybe_unused]] caller_location
+){
+	auto pool = (Pool*)impl;
+	switch (mode) {
+	case Allocator_Mode::query: {
+		u32 capabilities = can_free_any_order | can_free_all | can_resize;
+		return (void*)(uintptr)capabilities;
+	} break;
+
+	case Allocator_Mode::alloc_non_zero:
+	case Allocator_Mode::alloc: {
+		if(!mem::valid_alignment(align) || align > pool->block_align){
+			return _alloc_failed(Allocator_Error::bad_align);
+		}
+		if(size > pool->block_size){
+			return _alloc_failed(Allocator_Error::out_of_memory);
+		}
+		void* p = pool->alloc();
+		if(!p){
+			return _alloc_failed(Allocator_Error::out_of_memory);
+		}
+		if(mode == Allocator_Mode::alloc){
+			mem::set(p, 0, size);
+		}
+		return p;
+	} break;
+
+	case Allocator_Mode::resize: {
+		return size <= pool->block_size ? ptr : nullptr;
+	} break;
+
+	case Allocator_Mode::free: {
+		pool->free(ptr);
+	} break;
+
+	case Allocator_Mode::free_all: {
+		pool->free_all();
+	} break;
+	}
+
+	return nullptr;
+}
+
+inline Allocator Pool::allocator(){
+	return Allocator::from(
+		(void*)this,
+		_pool_allocator_func
+	);
+}
+}
+
+/* ---------------- Dynamic Array ---------------- */
+template<typename T>
+struct Dynamic_Array {
+	T* data = nullptr;
+	isize length = 0;
+	isize capacity = 0;
+	mem::Allocator allocator;
+
+	auto len() const { return length; }
+
+	auto cap() const { return capacity; }
+
+	// Change capacity, truncating if needed. On failure the array is left
+	// untouched and the error is returned (or thrown, see Allocator::alloc)
+	mem::Allocator_Error resize(isize new_cap){
+		isize new_size = new_cap * sizeof(T);
+		isize old_size = capacity * sizeof(T);
 
 		void* new_data = allocator.resize((void*) data, new_size, old_size);
 		if(new_data == nullptr){
 			new_data = allocator.alloc(new_size, alignof(T));
+			if(new_data == nullptr){
+				return mem::last_error();
+			}
+			if(data != nullptr){
+				mem::copy_no_overlap(new_data, data, min(length, new_cap) * sizeof(T));
+				allocator.free(data, old_size);
+			}
 		}
 
-		mem::copy(new_data, data, min(new_size, old_size));
-		allocator.free(data, old_size);
-
 		data     = (T*)new_data;
 		capacity = new_cap;
 		length   = min(length, new_cap);
+		return mem::Allocator_Error::none;
 	}
 
-	void append(T val){
+	[[nodiscard]]
+	mem::Allocator_Error append(T val){
 		if(length >= capacity){
-			resize(max(isize(16), length * 2));
+			auto err = resize(max(isize(16), length * 2));
+			if(err != mem::Allocator_Error::none){ return err; }
 		}
 		data[length] = val;
 		length += 1;
+		return mem::Allocator_Error::none;
 	}
 
 	void pop(){
-		length = min(length - 1, isize(0));
+		length = max(length - 1, isize(0));
 	}
 
-	void insert(isize idx, T val){
+	[[nodiscard]]
+	mem::Allocator_Error insert(isize idx, T val){
 		bounds_check(idx >= 0 && idx <= length, "Index out of bounds");
 		if(length >= capacity){
-			resize(max(isize(16), length * 2));
+			auto err = resize(max(isize(16), length * 2));
+			if(err != mem::Allocator_Error::none){ return err; }
 		}
 		mem::copy(&data[idx+1], &data[idx], sizeof(T) * (length - idx));
 		data[idx] = val;
 		length += 1;
+		return mem::Allocator_Error::none;
 	}
 
 	void remove(isize idx){
-		bounds_check(idx >= 0 && idx <= length, "Index out of bounds");
-		if(length <= 0){ return; }
-		mem::copy(&data[idx], &data[idx+1], sizeof(T) * (length - idx));
+		bounds_check(idx >= 0 && idx < length, "Index out of bounds");
+		mem::copy(&data[idx], &data[idx+1], sizeof(T) * (length - idx - 1));
 		length -= 1;
 	}
 
 	T& operator[](isize idx){
-		bounds_check(idx >= 0 && idx <= length, "Index out of bounds");
+		bounds_check(idx >= 0 && idx < length, "Index out of bounds");
 		return data[idx];
 	}
 
 	T const& operator[](isize idx) const {
-		bounds_check(idx >= 0 && idx <= length, "Index out of bounds");
+		bounds_check(idx >= 0 && idx < length, "Index out of bounds");
 		return data[idx];
 	}
 
@@ -1430,7 +2600,7 @@ struct Dynamic_Array {
 		arr.allocator = allocator;
 		if(initial_cap > 0){
 			arr.data = (T*)allocator.alloc(sizeof(T) * initial_cap, alignof(T));
-			arr.capacity = initial_cap;
+			arr.capacity = arr.data ? initial_cap : 0;
 		}
 		return arr;
 	}
@@ -1441,102 +2611,4370 @@ struct Dynamic_Array {
 	auto index_iter() { return sub().index_iter(); }
 
 	void destroy(){
-		allocator.free(data);
+		allocator.free(data, capacity * sizeof(T));
 		data = nullptr;
 		capacity = 0;
+		length = 0;
 	}
 };
 
 
-/* ---------------- Bit Vec ---------------- */
-template<int N>
-struct Bit_Vec {
-	static constexpr int byte_length = mem::align_forward(N, 8);
-	vec<u8, byte_length> data {0};
+/* ---------------- Sorting ---------------- */
+// Default ordering for sort() and the binary searches
+struct Less_Than {
+	template<typename T>
+	constexpr bool operator()(T const& a, T const& b) const { return a < b; }
+};
 
-	static constexpr u8 hi_bit = 128;
+namespace _sort {
+constexpr inline isize insertion_threshold = 24;
+constexpr inline isize ninther_threshold = 128;
+constexpr inline isize partial_insertion_limit = 8;
 
-	constexpr auto len() const { return N; }
-	constexpr auto byte_len() const { return byte_length; }
+template<typename T>
+static inline void swap(T& a, T& b){
+	T t = static_cast<T&&>(a);
+	a = static_cast<T&&>(b);
+	b = static_cast<T&&>(t);
+}
 
-	bool get(isize idx) const {
-		auto [cell, offset] = div_rem<isize>(idx, 8);
-		return (data[cell] & (hi_bit >> offset)) != 0;
+template<typename T, typename Less>
+static inline void sort2(T* a, T* b, Less& less){
+	if(less(*b, *a)){ swap(*a, *b); }
+}
+
+template<typename T, typename Less>
+static inline void sort3(T* a, T* b, T* c, Less& less){
+	sort2(a, b, less);
+	sort2(b, c, less);
+	sort2(a, b, less);
+}
+
+template<typename T, typename Less>
+static inline void insertion_sort(T* begin, T* end, Less& less){
+	if(begin == end){ return; }
+	for(T* cur = begin + 1; cur != end; cur++){
+		if(less(*cur, *(cur - 1))){
+			T tmp = static_cast<T&&>(*cur);
+			T* sift = cur;
+			do {
+				*sift = static_cast<T&&>(*(sift - 1));
+				sift -= 1;
+			} while(sift != begin && less(tmp, *(sift - 1)));
+			*sift = static_cast<T&&>(tmp);
+		}
 	}
+}
 
-	void set(isize idx, bool val){
-		auto [cell, offset] = div_rem<isize>(idx, 8);
-		if(val){
-			data[cell] |= (hi_bit >> offset);
-		} else {
-			data[cell] &= ~(hi_bit >> offset);
+// Requires an element before `begin` that is not greater than any in the range
+template<typename T, typename Less>
+static inline void unguarded_insertion_sort(T* begin, T* end, Less& less){
+	if(begin == end){ return; }
+	for(T* cur = begin + 1; cur != end; cur++){
+		if(less(*cur, *(cur - 1))){
+			T tmp = static_cast<T&&>(*cur);
+			T* sift = cur;
+			do {
+				*sift = static_cast<T&&>(*(sift - 1));
+				sift -= 1;
+			} while(less(tmp, *(sift - 1)));
+			*sift = static_cast<T&&>(tmp);
 		}
 	}
-};
+}
 
-/* TODO: Faster implementation using mem::compare for the first segment. */
-template<int N> constexpr
-auto operator==(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	for(int i = 0; i < a.len(); i ++){
-		if(a.get(i) != b.get(i)){ return false; }
+// Insertion sort that gives up after moving too many elements
+template<typename T, typename Less>
+static inline bool partial_insertion_sort(T* begin, T* end, Less& less){
+	if(begin == end){ return true; }
+	isize moved = 0;
+	for(T* cur = begin + 1; cur != end; cur++){
+		if(moved > partial_insertion_limit){ return false; }
+		if(less(*cur, *(cur - 1))){
+			T tmp = static_cast<T&&>(*cur);
+			T* sift = cur;
+			do {
+				*sift = static_cast<T&&>(*(sift - 1));
+				sift -= 1;
+			} while(sift != begin && less(tmp, *(sift - 1)));
+			*sift = static_cast<T&&>(tmp);
+			moved += cur - sift;
+		}
 	}
 	return true;
 }
 
-template<int N> constexpr
-auto operator!=(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	for(int i = 0; i < a.len(); i ++){
-		if(a.get(i) != b.get(i)){ return true; }
+template<typename T, typename Less>
+static inline void sift_down(T* data, isize root, isize n, Less& less){
+	for(;;){
+		isize child = 2 * root + 1;
+		if(child >= n){ return; }
+		if(child + 1 < n && less(data[child], data[child + 1])){ child += 1; }
+		if(!less(data[root], data[child])){ return; }
+		swap(data[root], data[child]);
+		root = child;
 	}
-	return false;
 }
 
-template<int N> constexpr
-auto operator|(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	Bit_Vec<N> res;
-	res.data = a.data | b.data;
-	return res;
+template<typename T, typename Less>
+static inline void heapsort(T* begin, T* end, Less& less){
+	isize n = end - begin;
+	for(isize i = n / 2 - 1; i >= 0; i--){
+		sift_down(begin, i, n, less);
+	}
+	for(isize i = n - 1; i > 0; i--){
+		swap(begin[0], begin[i]);
+		sift_down(begin, 0, i, less);
+	}
 }
 
-template<int N> constexpr
-auto operator+(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	return a | b;
+struct Partition {
+	void* pivot;
+	bool already_partitioned;
+};
+
+// Partition around *begin, elements equal to the pivot go to the right.
+template<typename T, typename Less>
+static inline Partition partition_right(T* begin, T* end, Less& less){
+	T pivot = static_cast<T&&>(*begin);
+	T* first = begin;
+	T* last = end;
+
+	while(less(*++first, pivot));
+	if(first - 1 == begin){
+		while(first < last && !less(*--last, pivot));
+	} else {
+		while(!less(*--last, pivot));
+	}
+
+	bool already_partitioned = first >= last;
+	while(first < last){
+		swap(*first, *last);
+		while(less(*++first, pivot));
+		while(!less(*--last, pivot));
+	}
+
+	T* pivot_pos = first - 1;
+	*begin = static_cast<T&&>(*pivot_pos);
+	*pivot_pos = static_cast<T&&>(pivot);
+	return {pivot_pos, already_partitioned};
 }
 
-template<int N> constexpr
-auto operator~(Bit_Vec<N> const& a){
-	Bit_Vec<N> res;
-	res.data = ~a.data;
-	return res;
+// Partition around *begin, elements equal to the pivot go to the left. Used
+// when the pivot equals the previous one, which puts a whole run of equal
+// elements in place at once.
+template<typename T, typename Less>
+static inline T* partition_left(T* begin, T* end, Less& less){
+	T pivot = static_cast<T&&>(*begin);
+	T* first = begin;
+	T* last = end;
+
+	while(less(pivot, *--last));
+	if(last + 1 == end){
+		while(first < last && !less(pivot, *++first));
+	} else {
+		while(!less(pivot, *++first));
+	}
+
+	while(first < last){
+		swap(*first, *last);
+		while(less(pivot, *--last));
+		while(!less(pivot, *++first));
+	}
+
+	T* pivot_pos = last;
+	*begin = static_cast<T&&>(*pivot_pos);
+	*pivot_pos = static_cast<T&&>(pivot);
+	return pivot_pos;
 }
 
-// Alias to ~a
-template<int N> constexpr
-auto operator!(Bit_Vec<N> const& a){
-	return ~a;
+template<typename T, typename Less>
+static inline void pdqsort(T* begin, T* end, Less& less, int bad_allowed, bool leftmost){
+	for(;;){
+		isize size = end - begin;
+		if(size < insertion_threshold){
+			if(leftmost){
+				insertion_sort(begin, end, less);
+			} else {
+				unguarded_insertion_sort(begin, end, less);
+			}
+			return;
+		}
+
+		/* Pivot: median of 3, or pseudo median of 9 for larger ranges */
+		isize half = size / 2;
+		if(size > ninther_threshold){
+			sort3(begin, begin + half, end - 1, less);
+			sort3(begin + 1, begin + (half - 1), end - 2, less);
+			sort3(begin + 2, begin + (half + 1), end - 3, less);
+			sort3(begin + (half - 1), begin + half, begin + (half + 1), less);
+			swap(*begin, *(begin + half));
+		} else {
+			sort3(begin + half, begin, end - 1, less);
+		}
+
+		if(!leftmost && !less(*(begin - 1), *begin)){
+			begin = partition_left(begin, end, less) + 1;
+			continue;
+		}
+
+		Partition part = partition_right(begin, end, less);
+		T* pivot_pos = (T*)part.pivot;
+		isize l_size = pivot_pos - begin;
+		isize r_size = end - (pivot_pos + 1);
+
+		if(l_size < size / 8 || r_size < size / 8){
+			/* Bad partition: after too many of them, switch to heapsort.
+			 * Otherwise break up patterns that may have caused it. */
+			bad_allowed -= 1;
+			if(bad_allowed == 0){
+				heapsort(begin, end, less);
+				return;
+			}
+			if(l_size >= insertion_threshold){
+				swap(*begin, *(begin + l_size / 4));
+				swap(*(pivot_pos - 1), *(pivot_pos - l_size / 4));
+				if(l_size > ninther_threshold){
+					swap(*(begin + 1), *(begin + (l_size / 4 + 1)));
+					swap(*(begin + 2), *(begin + (l_size / 4 + 2)));
+					swap(*(pivot_pos - 2), *(pivot_pos - (l_size / 4 + 1)));
+					swap(*(pivot_pos - 3), *(pivot_pos - (l_size / 4 + 2)));
+				}
+			}
+			if(r_size >= insertion_threshold){
+				swap(*(pivot_pos + 1), *(pivot_pos + (1 + r_size / 4)));
+				swap(*(end - 1), *(end - r_size / 4));
+				if(r_size > ninther_threshold){
+					swap(*(pivot_pos + 2), *(pivot_pos + (2 + r_size / 4)));
+					swap(*(pivot_pos + 3), *(pivot_pos + (3 + r_size / 4)));
+					swap(*(end - 2), *(end - (1 + r_size / 4)));
+					swap(*(end - 3), *(end - (2 + r_size / 4)));
+				}
+			}
+		}
+		else if(part.already_partitioned
+			&& partial_insertion_sort(begin, pivot_pos, less)
+			&& partial_insertion_sort(pivot_pos + 1, end, less)){
+			/* Input was (nearly) sorted already */
+			return;
+		}
+
+		pdqsort(begin, pivot_pos, less, bad_allowed, leftmost);
+		begin = pivot_pos + 1;
+		leftmost = false;
+	}
 }
 
-template<int N> constexpr
-auto operator&(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	Bit_Vec<N> res;
-	res.data = a.data & b.data;
-	return res;
+// Unsigned key with the same ordering as `k`
+template<typename K>
+static inline auto radix_key(K k){
+	static_assert(std::is_arithmetic_v<K>, "Radix keys must be integers or floats");
+	if constexpr(std::is_floating_point_v<K>){
+		using U = std::conditional_t<sizeof(K) == 4, u32, u64>;
+		constexpr U sign = U(1) << (sizeof(U) * 8 - 1);
+		U bits = bit_cast<U>(k);
+		return (bits & sign) ? U(~bits) : U(bits | sign);
+	}
+	else if constexpr(std::is_signed_v<K>){
+		using U = std::make_unsigned_t<K>;
+		return U(U(k) ^ (U(1) << (sizeof(U) * 8 - 1)));
+	}
+	else {
+		return k;
+	}
 }
 
-template<int N> constexpr
-auto operator^(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	Bit_Vec<N> res;
-	res.data = a.data ^ b.data;
-	return res;
+template<typename T, typename Less>
+static inline void merge(T const* a, isize na, T const* b, isize nb, T* out, Less& less){
+	isize i = 0, j = 0, k = 0;
+	while(i < na && j < nb){
+		bool take_b = less(b[j], a[i]);
+		out[k++] = take_b ? b[j] : a[i];
+		j += take_b;
+		i += !take_b;
+	}
+	mem::copy_no_overlap(&out[k], &a[i], (na - i) * sizeof(T));
+	k += na - i;
+	mem::copy_no_overlap(&out[k], &b[j], (nb - j) * sizeof(T));
 }
 
-template<int N> constexpr
-auto operator-(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
-	Bit_Vec<N> res;
-	res.data = a.data & ~b.data;
-	return res;
+// Byte `depth` of `s` shifted by one, 0 marks the end of the string
+static inline isize string_digit(string const& s, isize depth){
+	return depth < s.len() ? isize(s.raw_data()[depth]) + 1 : 0;
 }
 
-/* ---------------- Hash Map ---------------- */
+static inline bool string_less_from(string const& a, string const& b, isize depth){
+	isize n = min(a.len(), b.len()) - depth;
+	if(n > 0){
+		i32 c = mem::compare(a.raw_data() + depth, b.raw_data() + depth, n);
+		if(c != 0){ return c < 0; }
+	}
+	return a.len() < b.len();
+}
+
+// Levels of byte buckets before string_radix() falls back to comparison sorting
+constexpr inline isize string_radix_levels = 32;
+constexpr inline isize string_radix_buckets = 258;
+
+// MSD radix sort on byte `depth`, strings in `a` share their first `depth`
+// bytes. `counts` holds string_radix_buckets entries for each of the
+// `levels` left, so the recursion keeps its bucket offsets off the stack.
+static inline void string_radix(string* a, string* tmp, isize n, isize depth, isize* counts, isize levels){
+	if(n < 32){
+		auto less = [depth](string const& x, string const& y){ return string_less_from(x, y, depth); };
+		insertion_sort(a, a + n, less);
+		return;
+	}
 
+	/* Skip the bytes every string shares, a long common prefix costs one pass instead of a level per byte */
+	isize common = a[0].len() - depth;
+	for(isize i = 1; i < n && common > 0; i++){
+		isize m = min(common, a[i].len() - depth);
+		byte const* x = a[0].raw_data() + depth;
+		byte const* y = a[i].raw_data() + depth;
+		isize k = 0;
+		while(k < m && x[k] == y[k]){ k += 1; }
+		common = k;
+	}
+	depth += common;
+
+	if(levels == 0){
+		auto less = [depth](string const& x, string const& y){ return string_less_from(x, y, depth); };
+		pdqsort(a, a + n, less, std::bit_width(usize(n)), true);
+		return;
+	}
+
+	/* After the scatter ends[d] is one past the last string of bucket d */
+	isize* ends = counts;
+	mem::set(ends, 0, string_radix_buckets * sizeof(isize));
+	for(isize i = 0; i < n; i++){
+		ends[string_digit(a[i], depth) + 1] += 1;
+	}
+	for(isize d = 1; d < string_radix_buckets; d++){
+		ends[d] += ends[d - 1];
+	}
+	for(isize i = 0; i < n; i++){
+		tmp[ends[string_digit(a[i], depth)]++] = a[i];
+	}
+	mem::copy_no_overlap(a, tmp, n * sizeof(string));
+
+	/* Bucket 0 holds strings that ended, they are all equal */
+	for(isize d = 1; d < string_radix_buckets - 1; d++){
+		isize begin = ends[d - 1];
+		isize size = ends[d] - begin;
+		if(size > 1){
+			string_radix(&a[begin], tmp, size, depth + 1, counts + string_radix_buckets, levels - 1);
+		}
+	}
+}
+}
+
+// Unstable in-place sort (pattern-defeating quicksort). O(n log n) worst case,
+// linear on sorted, reversed and all-equal inputs.
+template<typename T, typename Less = Less_Than>
+void sort(slice<T> s, Less less = {}){
+	isize n = s.len();
+	if(n < 2){ return; }
+	_sort::pdqsort(s.raw_data(), s.raw_data() + n, less, std::bit_width(usize(n)), true);
+}
+
+template<typename T, typename Less = Less_Than>
+bool is_sorted(slice<T> s, Less less = {}){
+	for(isize i = 1; i < s.len(); i++){
+		if(less(s[i], s[i - 1])){ return false; }
+	}
+	return true;
+}
+
+// LSD radix sort by an integer or float key, 8 bits per pass. Passes where
+// every key has the same digit are skipped. The scratch buffer (n elements)
+// comes from `scratch`, if it can't be allocated this falls back to sort().
+template<typename T, typename Key>
+void radix_sort_by(slice<T> s, mem::Allocator scratch, Key key){
+	static_assert(std::is_trivially_copyable_v<T>, "Radix sort moves elements with memcpy");
+	isize n = s.len();
+	T* data = s.raw_data();
+	auto key_less = [&](T const& a, T const& b){ return _sort::radix_key(key(a)) < _sort::radix_key(key(b)); };
+	if(n < 256){
+		sort(s, key_less);
+		return;
+	}
+
+	using U = decltype(_sort::radix_key(key(data[0])));
+	constexpr int passes = sizeof(U);
+	isize counts[passes][256] = {};
+	for(isize i = 0; i < n; i++){
+		U k = _sort::radix_key(key(data[i]));
+		for(int p = 0; p < passes; p++){
+			counts[p][(k >> (p * 8)) & 0xff] += 1;
+		}
+	}
+
+	auto res = scratch.try_alloc_non_zero(n * sizeof(T), alignof(T));
+	if(!res.ok()){
+		sort(s, key_less);
+		return;
+	}
+	T* tmp = (T*)res.unwrap();
+
+	T* src = data;
+	T* dst = tmp;
+	U first_key = _sort::radix_key(key(data[0]));
+	for(int p = 0; p < passes; p++){
+		int shift = p * 8;
+		if(counts[p][(first_key >> shift) & 0xff] == n){ continue; }
+
+		isize offsets[256];
+		isize total = 0;
+		for(int d = 0; d < 256; d++){
+			offsets[d] = total;
+			total += counts[p][d];
+		}
+		for(isize i = 0; i < n; i++){
+			U k = _sort::radix_key(key(src[i]));
+			dst[offsets[(k >> shift) & 0xff]++] = src[i];
+		}
+		_sort::swap(src, dst);
+	}
+
+	if(src != data){
+		mem::copy_no_overlap(data, src, n * sizeof(T));
+	}
+	scratch.free(tmp, n * sizeof(T));
+}
+
+template<typename T>
+void radix_sort(slice<T> s, mem::Allocator scratch){
+	radix_sort_by(s, scratch, [](T const& x){ return x; });
+}
+
+// MSD radix sort of strings in byte order. The scratch buffer falls back to sort() like radix_sort_by()
+static inline
+void radix_sort(slice<string> s, mem::Allocator scratch){
+	isize n = s.len();
+	if(n < 2){ return; }
+	isize size = n * sizeof(string) + _sort::string_radix_levels * _sort::string_radix_buckets * sizeof(isize);
+	auto res = scratch.try_alloc_non_zero(size, alignof(string));
+	if(!res.ok()){
+		sort(s);
+		return;
+	}
+	auto tmp = (string*)res.unwrap();
+	auto counts = (isize*)&tmp[n];
+	_sort::string_radix(s.raw_data(), tmp, n, 0, counts, _sort::string_radix_levels);
+	scratch.free(tmp, size);
+}
+
+// Index of the first element not less than `key` (s.len() if none). The loop
+// has no data dependent branches, the compiler turns the step into a cmov.
+template<typename T, typename Less = Less_Than>
+isize lower_bound(slice<T> s, T const& key, Less less = {}){
+	isize n = s.len();
+	if(n == 0){ return 0; }
+	T const* base = s.raw_data();
+	while(n > 1){
+		isize half = n / 2;
+		base = less(base[half], key) ? base + half : base;
+		n -= half;
+	}
+	return (base - s.raw_data()) + less(*base, key);
+}
+
+// Index of the first element greater than `key` (s.len() if none)
+template<typename T, typename Less = Less_Than>
+isize upper_bound(slice<T> s, T const& key, Less less = {}){
+	isize n = s.len();
+	if(n == 0){ return 0; }
+	T const* base = s.raw_data();
+	while(n > 1){
+		isize half = n / 2;
+		base = !less(key, base[half]) ? base + half : base;
+		n -= half;
+	}
+	return (base - s.raw_data()) + !less(key, *base);
+}
+
+constexpr inline isize parallel_sort_min_chunk = 1 << 16;
+
+// Merge sort on up to `thread_count` threads (0: one per hardware thread).
+// Chunks are sorted with sort() and merged pairwise, each merge is split into
+// independent pieces so every round keeps all threads busy. Small inputs, or
+// failing to get the n element scratch buffer, fall back to sort().
+template<typename T, typename Less = Less_Than>
+void parallel_sort(slice<T> s, mem::Allocator scratch, Less less = {}, isize thread_count = 0){
+	static_assert(std::is_trivially_copyable_v<T>, "Parallel sort moves elements with memcpy");
+	constexpr isize max_chunks = 64;
+	isize n = s.len();
+	if(thread_count <= 0){
+		thread_count = max(isize(1), isize(std::thread::hardware_concurrency()));
+	}
+
+	isize chunks = 1;
+	while(chunks * 2 <= min(thread_count, max_chunks) && n / (chunks * 2) >= parallel_sort_min_chunk){
+		chunks *= 2;
+	}
+	if(chunks == 1){
+		sort(s, less);
+		return;
+	}
 
+	auto res = scratch.try_alloc_non_zero(n * sizeof(T), alignof(T));
+	if(!res.ok()){
+		sort(s, less);
+		return;
+	}
+	T* tmp = (T*)res.unwrap();
+
+	T* data = s.raw_data();
+	auto bound = [n, chunks](isize i){ return n * i / chunks; };
+	std::thread workers[max_chunks];
+
+	for(isize c = 1; c < chunks; c++){
+		workers[c] = std::thread([=]{
+			sort(slice<T>::from(&data[bound(c)], bound(c + 1) - bound(c)), less);
+		});
+	}
+	sort(slice<T>::from(&data[0], bound(1)), less);
+	for(isize c = 1; c < chunks; c++){ workers[c].join(); }
+
+	T* src = data;
+	T* dst = tmp;
+	for(isize width = 1; width < chunks; width *= 2){
+		/* Each merge of two runs gets 2 * width tasks: the left run is cut
+		 * evenly and the right run is cut where those pivots would go */
+		isize parts = 2 * width;
+		auto task = [=](isize t){
+			isize m = t / parts;
+			isize j = t % parts;
+			isize lo = bound(m * 2 * width);
+			isize mid = bound(m * 2 * width + width);
+			isize hi = bound(m * 2 * width + 2 * width);
+			auto a = slice<T>::from(&src[lo], mid - lo);
+			auto b = slice<T>::from(&src[mid], hi - mid);
+			isize a0 = a.len() * j / parts;
+			isize a1 = a.len() * (j + 1) / parts;
+			isize b0 = j == 0 ? 0 : lower_bound(b, a[a0], less);
+			isize b1 = j == parts - 1 ? b.len() : lower_bound(b, a[a1], less);
+			_sort::merge(&a.raw_data()[a0], a1 - a0, &b.raw_data()[b0], b1 - b0, &dst[lo + a0 + b0], less);
+		};
+		for(isize t = 1; t < chunks; t++){
+			workers[t] = std::thread(task, t);
+		}
+		task(0);
+		for(isize t = 1; t < chunks; t++){ workers[t].join(); }
+		_sort::swap(src, dst);
+	}
+
+	if(src != data){
+		mem::copy_no_overlap(data, src, n * sizeof(T));
+	}
+	scratch.free(tmp, n * sizeof(T));
+}
+
+/* ---------------- Priority Queue ---------------- */
+// d-ary heap on a Dynamic_Array. top() is the element that is smallest
+// according to `Less` (reverse it for a max-heap). Wider nodes make the heap
+// shallower and keep the children of a node on one or two cache lines, 4 is a
+// good default.
+namespace _heap {
+template<int Arity, typename T, typename Less>
+static inline void sift_up(T* data, isize i, Less& less){
+	T x = static_cast<T&&>(data[i]);
+	while(i > 0){
+		isize parent = (i - 1) / Arity;
+		if(!less(x, data[parent])){ break; }
+		data[i] = static_cast<T&&>(data[parent]);
+		i = parent;
+	}
+	data[i] = static_cast<T&&>(x);
+}
+
+template<int Arity, typename T, typename Less>
+static inline void sift_down(T* data, isize i, isize n, Less& less){
+	T x = static_cast<T&&>(data[i]);
+	for(;;){
+		isize first = i * Arity + 1;
+		if(first >= n){ break; }
+		isize last = min(first + Arity, n);
+		isize best = first;
+		for(isize c = first + 1; c < last; c++){
+			best = less(data[c], data[best]) ? c : best;
+		}
+		if(!less(data[best], x)){ break; }
+		data[i] = static_cast<T&&>(data[best]);
+		i = best;
+	}
+	data[i] = static_cast<T&&>(x);
+}
+
+template<int Arity, typename T, typename Less>
+static inline void heapify(T* data, isize n, Less& less){
+	for(isize i = (n - 2) / Arity; i >= 0 && n > 1; i--){
+		sift_down<Arity>(data, i, n, less);
+	}
+}
+}
+
+template<typename T, typename Less = Less_Than, int Arity = 4>
+struct Priority_Queue {
+	static_assert(Arity >= 2, "Heap arity must be at least 2");
+	Dynamic_Array<T> items;
+	[[no_unique_address]] Less less;
+
+	auto len() const { return items.len(); }
+
+	bool empty() const { return items.len() == 0; }
+
+	T const& top() const {
+		return items[0];
+	}
+
+	mem::Allocator_Error push(T x){
+		auto err = items.append(x);
+		if(err != mem::Allocator_Error::none){ return err; }
+		_heap::sift_up<Arity>(items.data, items.len() - 1, less);
+		return err;
+	}
+
+	Option<T> pop(){
+		if(items.len() == 0){ return {}; }
+		T res = items.data[0];
+		items.length -= 1;
+		if(items.len() > 0){
+			items.data[0] = items.data[items.len()];
+			_heap::sift_down<Arity>(items.data, 0, items.len(), less);
+		}
+		return res;
+	}
+
+	// Replace the top with `x`, cheaper than pop() followed by push()
+	void replace_top(T x){
+		items[0] = x;
+		_heap::sift_down<Arity>(items.data, 0, items.len(), less);
+	}
+
+	// Append all of `s` and restore the heap in O(n)
+	mem::Allocator_Error push_slice(slice<T> s){
+		isize old_len = items.len();
+		if(old_len + s.len() > items.cap()){
+			auto err = items.resize(old_len + s.len());
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		mem::copy_no_overlap(&items.data[old_len], s.raw_data(), s.len() * sizeof(T));
+		items.length += s.len();
+		_heap::heapify<Arity>(items.data, items.len(), less);
+		return mem::Allocator_Error::none;
+	}
+
+	// Restore the heap after modifying `items` directly
+	void heapify(){
+		_heap::heapify<Arity>(items.data, items.len(), less);
+	}
+
+	void clear(){
+		items.length = 0;
+	}
+
+	static Priority_Queue from(mem::Allocator allocator, isize initial_cap = 16, Less less = {}){
+		Priority_Queue q;
+		q.items = Dynamic_Array<T>::from(allocator, initial_cap);
+		q.less = less;
+		return q;
+	}
+
+	// Build a heap holding a copy of `s` in O(n)
+	static Priority_Queue from_slice(mem::Allocator allocator, slice<T> s, Less less = {}){
+		auto q = from(allocator, s.len(), less);
+		q.push_slice(s);
+		return q;
+	}
+
+	void destroy(){
+		items.destroy();
+	}
+};
+
+// Keeps the `k` greatest elements pushed (by `Less`) without ever growing past
+// k. Internally a heap of the k best so far, rooted at the worst of them.
+template<typename T, typename Less = Less_Than, int Arity = 4>
+struct Top_K {
+	Priority_Queue<T, Less, Arity> heap;
+	isize k = 0;
+
+	auto len() const { return heap.len(); }
+
+	// Smallest element kept, the one next in line to be evicted
+	T const& threshold() const {
+		return heap.top();
+	}
+
+	// Returns true if `x` was kept
+	bool push(T x){
+		if(heap.len() < k){
+			return heap.push(x) == mem::Allocator_Error::none;
+		}
+		if(k == 0 || !heap.less(heap.top(), x)){
+			return false;
+		}
+		heap.replace_top(x);
+		return true;
+	}
+
+	// Kept elements in heap order
+	slice<T> items(){
+		return heap.items.sub();
+	}
+
+	// Sort the kept elements greatest first into `out` (len() elements), emptying the set
+	void drain_sorted(slice<T> out){
+		bounds_check(out.len() >= heap.len(), "Output slice too small");
+		for(isize i = heap.len() - 1; i >= 0; i--){
+			out[i] = heap.pop().unwrap_unchecked();
+		}
+	}
+
+	static Top_K from(mem::Allocator allocator, isize k, Less less = {}){
+		Top_K t;
+		t.heap = Priority_Queue<T, Less, Arity>::from(allocator, max(k, isize(1)), less);
+		t.k = k;
+		return t;
+	}
+
+	void destroy(){
+		heap.destroy();
+	}
+};
+
+// Heap of integer ids in [0, n) ordered by a priority stored per id, with
+// O(log n) decrease_key() for Dijkstra/A* style workloads. Id storage grows
+// to the largest id pushed.
+template<typename T, typename Less = Less_Than, int Arity = 4>
+struct Indexed_Priority_Queue {
+	static_assert(Arity >= 2, "Heap arity must be at least 2");
+	Dynamic_Array<isize> heap;      /* Ids in heap order */
+	Dynamic_Array<isize> positions; /* Heap index per id, -1 if not queued */
+	Dynamic_Array<T> priorities;    /* Priority per id */
+	[[no_unique_address]] Less less;
+
+	auto len() const { return heap.len(); }
+
+	bool empty() const { return heap.len() == 0; }
+
+	bool contains(isize id) const {
+		return id >= 0 && id < positions.len() && positions[id] >= 0;
+	}
+
+	T const& priority(isize id) const {
+		return priorities[id];
+	}
+
+	// Id with the smallest priority
+	isize top() const {
+		return heap[0];
+	}
+
+	// Queue `id`, or update its priority if already queued
+	mem::Allocator_Error push(isize id, T priority){
+		bounds_check(id >= 0, "Negative id");
+		while(positions.len() <= id){
+			auto err = positions.append(-1);
+			if(err == mem::Allocator_Error::none){ err = priorities.append(T{}); }
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		if(contains(id)){
+			update(id, priority);
+			return mem::Allocator_Error::none;
+		}
+		auto err = heap.append(id);
+		if(err != mem::Allocator_Error::none){ return err; }
+		priorities[id] = priority;
+		positions[id] = heap.len() - 1;
+		_sift_up(heap.len() - 1);
+		return mem::Allocator_Error::none;
+	}
+
+	// Lower the priority of a queued id
+	void decrease_key(isize id, T priority){
+		bounds_check(contains(id), "Id not in queue");
+		priorities[id] = priority;
+		_sift_up(positions[id]);
+	}
+
+	// Change the priority of a queued id in either direction
+	void update(isize id, T priority){
+		bounds_check(contains(id), "Id not in queue");
+		bool lowered = less(priority, priorities[id]);
+		priorities[id] = priority;
+		if(lowered){
+			_sift_up(positions[id]);
+		} else {
+			_sift_down(positions[id]);
+		}
+	}
+
+	// Remove and return the id with the smallest priority
+	Option<isize> pop(){
+		if(heap.len() == 0){ return {}; }
+		isize id = heap[0];
+		isize last = heap[heap.len() - 1];
+		heap.pop();
+		positions[id] = -1;
+		if(heap.len() > 0){
+			heap[0] = last;
+			positions[last] = 0;
+			_sift_down(0);
+		}
+		return id;
+	}
+
+	void clear(){
+		for(isize i = 0; i < heap.len(); i++){
+			positions[heap[i]] = -1;
+		}
+		heap.length = 0;
+	}
+
+	static Indexed_Priority_Queue from(mem::Allocator allocator, isize id_capacity = 16, Less less = {}){
+		Indexed_Priority_Queue q;
+		q.heap = Dynamic_Array<isize>::from(allocator, id_capacity);
+		q.positions = Dynamic_Array<isize>::from(allocator, id_capacity);
+		q.priorities = Dynamic_Array<T>::from(allocator, id_capacity);
+		q.less = less;
+		return q;
+	}
+
+	void destroy(){
+		heap.destroy();
+		positions.destroy();
+		priorities.destroy();
+	}
+
+	void _sift_up(isize i){
+		isize* ids = heap.data;
+		isize id = ids[i];
+		while(i > 0){
+			isize parent = (i - 1) / Arity;
+			if(!less(priorities.data[id], priorities.data[ids[parent]])){ break; }
+			ids[i] = ids[parent];
+			positions.data[ids[i]] = i;
+			i = parent;
+		}
+		ids[i] = id;
+		positions.data[id] = i;
+	}
+
+	void _sift_down(isize i){
+		isize* ids = heap.data;
+		isize n = heap.len();
+		isize id = ids[i];
+		for(;;){
+			isize first = i * Arity + 1;
+			if(first >= n){ break; }
+			isize last = min(first + Arity, n);
+			isize best = first;
+			for(isize c = first + 1; c < last; c++){
+				best = less(priorities.data[ids[c]], priorities.data[ids[best]]) ? c : best;
+			}
+			if(!less(priorities.data[ids[best]], priorities.data[id])){ break; }
+			ids[i] = ids[best];
+			positions.data[ids[i]] = i;
+			i = best;
+		}
+		ids[i] = id;
+		positions.data[id] = i;
+	}
+};
+
+/* ---------------- Slot Map ---------------- */
+// Values addressed through {index, generation} handles. Values live densely
+// (packed, in no particular order) for iteration, handles go through a slot
+// table to find them. Removing swaps the last value into the hole and bumps
+// the slot's generation, so old handles to it stop resolving. Generations
+// start at 1, a zeroed Handle is never valid.
+template<typename T>
+struct Slot_Map {
+	struct Handle {
+		u32 index = 0;
+		u32 generation = 0;
+
+		bool operator==(Handle const&) const = default;
+	};
+
+	struct Slot {
+		u32 target;     /* Dense index when occupied, next free slot otherwise */
+		u32 generation;
+		bool occupied;
+	};
+
+	static constexpr u32 no_slot = ~u32(0);
+
+	Dynamic_Array<T> values;
+	Dynamic_Array<u32> value_slots; /* Slot of each dense value */
+	Dynamic_Array<Slot> slots;
+	u32 free_head = no_slot;
+
+	auto len() const { return values.len(); }
+
+	Result<Handle, mem::Allocator_Error> insert(T value){
+		u32 index = free_head;
+		if(index == no_slot){
+			if(slots.len() >= isize(no_slot)){ return mem::Allocator_Error::out_of_memory; }
+			auto err = slots.append(Slot{no_slot, 1, false});
+			if(err != mem::Allocator_Error::none){ return err; }
+			index = u32(slots.len() - 1);
+		}
+
+		auto err = values.append(value);
+		if(err == mem::Allocator_Error::none){
+			err = value_slots.append(index);
+			if(err != mem::Allocator_Error::none){ values.pop(); }
+		}
+		if(err != mem::Allocator_Error::none){
+			if(index != free_head){ slots.pop(); }
+			return err;
+		}
+
+		Slot& slot = slots[index];
+		if(index == free_head){ free_head = slot.target; }
+		slot.target = u32(values.len() - 1);
+		slot.occupied = true;
+		return Handle{index, slot.generation};
+	}
+
+	bool contains(Handle h) const {
+		return h.index < u32(slots.len()) && slots[h.index].occupied && slots[h.index].generation == h.generation;
+	}
+
+	Option<T&> get(Handle h){
+		if(!contains(h)){ return {}; }
+		return values[slots[h.index].target];
+	}
+
+	Option<T const&> get(Handle h) const {
+		if(!contains(h)){ return {}; }
+		return values[slots[h.index].target];
+	}
+
+	// Remove the value behind `h`, returning it. Stale handles are ignored.
+	Option<T> remove(Handle h){
+		if(!contains(h)){ return {}; }
+		Slot& slot = slots[h.index];
+		isize dense = slot.target;
+		isize last = values.len() - 1;
+		T removed = values[dense];
+
+		if(dense != last){
+			values[dense] = values[last];
+			value_slots[dense] = value_slots[last];
+			slots[value_slots[dense]].target = u32(dense);
+		}
+		values.pop();
+		value_slots.pop();
+
+		slot.occupied = false;
+		slot.generation = slot.generation + 1 == 0 ? 1 : slot.generation + 1;
+		slot.target = free_head;
+		free_head = h.index;
+		return removed;
+	}
+
+	// Handle of the value at dense position `i`, to pair with sub()
+	Handle handle_at(isize i) const {
+		u32 index = value_slots[i];
+		return Handle{index, slots[index].generation};
+	}
+
+	// Dense view of every value, invalidated by insert() and remove()
+	slice<T> sub(){
+		return values.sub();
+	}
+
+	// Remove everything, invalidating all handles
+	void clear(){
+		for(isize i = 0; i < values.len(); i++){
+			u32 index = value_slots[i];
+			Slot& slot = slots[index];
+			slot.occupied = false;
+			slot.generation = slot.generation + 1 == 0 ? 1 : slot.generation + 1;
+			slot.target = free_head;
+			free_head = index;
+		}
+		values.length = 0;
+		value_slots.length = 0;
+	}
+
+	static Slot_Map from(mem::Allocator allocator, isize initial_cap = 16){
+		Slot_Map m;
+		m.values = Dynamic_Array<T>::from(allocator, initial_cap);
+		m.value_slots = Dynamic_Array<u32>::from(allocator, initial_cap);
+		m.slots = Dynamic_Array<Slot>::from(allocator, initial_cap);
+		return m;
+	}
+
+	void destroy(){
+		values.destroy();
+		value_slots.destroy();
+		slots.destroy();
+		free_head = no_slot;
+	}
+
+	/* C++ Iterator Insanity */
+	auto begin(){ return values.begin(); }
+	auto end(){ return values.end(); }
+};
+
+/* ---------------- SoA Array ---------------- */
+// Structure-of-arrays storage for vec<T, N>: component `c` of every element is
+// stored contiguously in `streams[c]`. All streams share one allocation, each
+// one aligned to a cache line and padded to a whole number of vector registers,
+// so bulk operations process `block` elements per instruction without a
+// scalar tail. Operations between two arrays expect them to have equal length.
+template<typename V>
+struct SoA_Array;
+
+template<typename T, int N>
+struct SoA_Array<vec<T, N>> {
+	static constexpr isize stream_align = 64;
+	static constexpr int block = max(isize(1), _vec_native::max_width / isize(sizeof(T)));
+	using Block = vec<T, block>;
+
+	T* streams[N] = {nullptr};
+	isize length = 0;
+	isize capacity = 0;
+	mem::Allocator allocator;
+
+	auto len() const { return length; }
+
+	auto cap() const { return capacity; }
+
+	// On failure the array is left untouched and the error is returned (or
+	// thrown, see Allocator::alloc)
+	mem::Allocator_Error resize(isize new_cap){
+		new_cap = mem::align_forward<isize>(max(new_cap, isize(1)), stream_align / sizeof(T));
+		isize keep = min(length, new_cap);
+
+		T* new_data = (T*)allocator.alloc(new_cap * N * sizeof(T), stream_align);
+		if(new_data == nullptr){
+			return mem::last_error();
+		}
+		if(streams[0] != nullptr){
+			for(int c = 0; c < N; c++){
+				mem::copy_no_overlap(&new_data[c * new_cap], streams[c], keep * sizeof(T));
+			}
+			allocator.free(streams[0], capacity * N * sizeof(T));
+		}
+
+		for(int c = 0; c < N; c++){
+			streams[c] = &new_data[c * new_cap];
+		}
+		capacity = new_cap;
+		length   = keep;
+		return mem::Allocator_Error::none;
+	}
+
+	mem::Allocator_Error append(vec<T, N> v){
+		if(length >= capacity){
+			auto err = resize(max(isize(16), length * 2));
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		for(int c = 0; c < N; c++){
+			streams[c][length] = v[c];
+		}
+		length += 1;
+		return mem::Allocator_Error::none;
+	}
+
+	vec<T, N> get(isize idx) const {
+		bounds_check(idx >= 0 && idx < length, "Index out of bounds");
+		vec<T, N> v;
+		for(int c = 0; c < N; c++){
+			v[c] = streams[c][idx];
+		}
+		return v;
+	}
+
+	void set(isize idx, vec<T, N> v){
+		bounds_check(idx >= 0 && idx < length, "Index out of bounds");
+		for(int c = 0; c < N; c++){
+			streams[c][idx] = v[c];
+		}
+	}
+
+	// View of a single component stream
+	slice<T> component(int c){
+		bounds_check(c >= 0 && c < N, "Invalid component");
+		return slice<T>::from(streams[c], length);
+	}
+
+	void clear(){
+		length = 0;
+	}
+
+	// Write elements back in AoS layout, `out` must hold at least len() elements
+	void to_aos(slice<vec<T, N>> out) const {
+		bounds_check(out.len() >= length, "Output slice is too small");
+		vec<T, N>* dst = out.raw_data();
+		for(isize i = 0; i < length; i++){
+			for(int c = 0; c < N; c++){
+				dst[i][c] = streams[c][i];
+			}
+		}
+	}
+
+	/* Bulk operations */
+	// this[i] += other[i]
+	void add(SoA_Array const& other){
+		bounds_check(other.length == length, "Mismatched lengths");
+		for(int c = 0; c < N; c++){
+			for(isize i = 0; i < length; i += block){
+				_block(c, i) = _block(c, i) + other._block(c, i);
+			}
+		}
+	}
+
+	// this[i] -= other[i]
+	void sub(SoA_Array const& other){
+		bounds_check(other.length == length, "Mismatched lengths");
+		for(int c = 0; c < N; c++){
+			for(isize i = 0; i < length; i += block){
+				_block(c, i) = _block(c, i) - other._block(c, i);
+			}
+		}
+	}
+
+	// this[i] += other[i] * s, e.g. integrating positions from velocities
+	void add_scaled(SoA_Array const& other, T s){
+		bounds_check(other.length == length, "Mismatched lengths");
+		for(int c = 0; c < N; c++){
+			for(isize i = 0; i < length; i += block){
+				_block(c, i) = _block(c, i) + other._block(c, i) * s;
+			}
+		}
+	}
+
+	// this[i] += offset
+	void translate(vec<T, N> offset){
+		for(int c = 0; c < N; c++){
+			for(isize i = 0; i < length; i += block){
+				_block(c, i) = _block(c, i) + offset[c];
+			}
+		}
+	}
+
+	// this[i] *= s
+	void scale(T s){
+		for(int c = 0; c < N; c++){
+			for(isize i = 0; i < length; i += block){
+				_block(c, i) = _block(c, i) * s;
+			}
+		}
+	}
+
+	// out[i] = dot(this[i], other[i]), `out` must hold at least len() elements
+	void dot(SoA_Array const& other, slice<T> out) const {
+		bounds_check(other.length == length, "Mismatched lengths");
+		bounds_check(out.len() >= length, "Output slice is too small");
+		T* dst = out.raw_data();
+		for(isize i = 0; i < length; i += block){
+			Block acc{};
+			for(int c = 0; c < N; c++){
+				acc = acc + _block(c, i) * other._block(c, i);
+			}
+			isize n = min(isize(block), length - i);
+			mem::copy_no_overlap(&dst[i], &acc, n * sizeof(T));
+		}
+	}
+
+	static SoA_Array from(mem::Allocator allocator, isize initial_cap = 16){
+		SoA_Array arr;
+		arr.allocator = allocator;
+		if(initial_cap > 0){
+			arr.resize(initial_cap);
+		}
+		return arr;
+	}
+
+	// Convert AoS elements into a new SoA_Array
+	static SoA_Array from_aos(mem::Allocator allocator, slice<vec<T, N>> data){
+		auto arr = from(allocator, data.len());
+		if(arr.capacity < data.len()){ return arr; }
+		vec<T, N> const* src = data.raw_data();
+		for(isize i = 0; i < data.len(); i++){
+			for(int c = 0; c < N; c++){
+				arr.streams[c][i] = src[i][c];
+			}
+		}
+		arr.length = data.len();
+		return arr;
+	}
+
+	void destroy(){
+		allocator.free(streams[0], capacity * N * sizeof(T));
+		for(int c = 0; c < N; c++){
+			streams[c] = nullptr;
+		}
+		capacity = 0;
+		length = 0;
+	}
+
+	Block& _block(int c, isize idx){
+		return *(Block*)&streams[c][idx];
+	}
+
+	Block const& _block(int c, isize idx) const {
+		return *(Block const*)&streams[c][idx];
+	}
+};
+
+/* ---------------- Bit Vec ---------------- */
+// Returns index of the first set bit at position >= `start`, or -1 if there's none
+static inline constexpr
+isize _find_set_bit(u64 const* words, isize word_count, isize start){
+	if(start < 0){ start = 0; }
+	isize w = start / 64;
+	if(w >= word_count){ return -1; }
+
+	u64 word = words[w] & (~u64(0) << (start % 64));
+	for(;;){
+		if(word != 0){
+			return w * 64 + std::countr_zero(word);
+		}
+		w += 1;
+		if(w >= word_count){ return -1; }
+		word = words[w];
+	}
+}
+
+namespace cpp_iter {
+// Iterates indices of set bits
+struct Set_Bit_Iterator {
+	u64 const* words;
+	isize word_count;
+	isize idx;
+
+	using value_type = isize;
+
+	constexpr isize operator*() const { return idx; }
+
+	constexpr void operator++(){ idx = _find_set_bit(words, word_count, idx + 1); }
+	constexpr void operator++(int){ idx = _find_set_bit(words, word_count, idx + 1); }
+
+	constexpr bool operator!=(Set_Bit_Iterator rhs){ return idx != rhs.idx; }
+};
+
+struct Set_Bit_Range {
+	u64 const* words;
+	isize word_count;
+
+	constexpr auto begin(){ return Set_Bit_Iterator{words, word_count, _find_set_bit(words, word_count, 0)}; }
+	constexpr auto end(){ return Set_Bit_Iterator{words, word_count, -1}; }
+};
+}
+
+// Fixed size bit set, bit `i` is stored in bit `i % 64` of word `i / 64`. Bits
+// past N in the last word are always kept at 0.
+template<int N>
+struct Bit_Vec {
+	static constexpr int word_count = (N + 63) / 64;
+	static constexpr int byte_length = (N + 7) / 8;
+	static constexpr u64 tail_mask = (N % 64 == 0) ? ~u64(0) : (u64(1) << (N % 64)) - 1;
+
+	vec<u64, word_count> data {0};
+
+	constexpr auto len() const { return N; }
+	constexpr auto byte_len() const { return byte_length; }
+
+	constexpr bool get(isize idx) const {
+		bounds_check(idx >= 0 && idx < N, "Out of bounds access to bit vec");
+		return (data[idx / 64] >> (idx % 64)) & 1;
+	}
+
+	constexpr void set(isize idx, bool val){
+		bounds_check(idx >= 0 && idx < N, "Out of bounds access to bit vec");
+		u64 bit = u64(1) << (idx % 64);
+		if(val){
+			data[idx / 64] |= bit;
+		} else {
+			data[idx / 64] &= ~bit;
+		}
+	}
+
+	// Number of set bits
+	constexpr isize count() const {
+		isize total = 0;
+		for(int i = 0; i < word_count; i++){
+			total += std::popcount(data[i]);
+		}
+		return total;
+	}
+
+	constexpr bool any() const {
+		u64 acc = 0;
+		for(int i = 0; i < word_count; i++){
+			acc |= data[i];
+		}
+		return acc != 0;
+	}
+
+	constexpr bool none() const {
+		return !any();
+	}
+
+	// Index of the first set bit, -1 if there's none
+	constexpr isize find_first_set() const {
+		return _find_set_bit(&data[0], word_count, 0);
+	}
+
+	// Index of the first set bit after `idx`, -1 if there's none
+	constexpr isize find_next_set(isize idx) const {
+		return _find_set_bit(&data[0], word_count, idx + 1);
+	}
+
+	// Iterate over indices of set bits: for(isize i : bits.set_bits()){ ... }
+	constexpr auto set_bits() const {
+		return cpp_iter::Set_Bit_Range{&data[0], word_count};
+	}
+};
+
+template<int N> constexpr
+auto operator==(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	u64 diff = 0;
+	for(int i = 0; i < Bit_Vec<N>::word_count; i++){
+		diff |= a.data[i] ^ b.data[i];
+	}
+	return diff == 0;
+}
+
+template<int N> constexpr
+auto operator!=(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	return !(a == b);
+}
+
+template<int N> constexpr
+auto operator|(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	Bit_Vec<N> res;
+	res.data = a.data | b.data;
+	return res;
+}
+
+template<int N> constexpr
+auto operator+(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	return a | b;
+}
+
+template<int N> constexpr
+auto operator~(Bit_Vec<N> const& a){
+	Bit_Vec<N> res;
+	res.data = ~a.data;
+	res.data[Bit_Vec<N>::word_count - 1] &= Bit_Vec<N>::tail_mask;
+	return res;
+}
+
+// Alias to ~a
+template<int N> constexpr
+auto operator!(Bit_Vec<N> const& a){
+	return ~a;
+}
+
+template<int N> constexpr
+auto operator&(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	Bit_Vec<N> res;
+	res.data = a.data & b.data;
+	return res;
+}
+
+template<int N> constexpr
+auto operator^(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	Bit_Vec<N> res;
+	res.data = a.data ^ b.data;
+	return res;
+}
+
+template<int N> constexpr
+auto operator-(Bit_Vec<N> const& a, Bit_Vec<N> const& b){
+	Bit_Vec<N> res;
+	res.data = a.data & ~b.data;
+	return res;
+}
+
+/* ---------------- Dynamic Bit Set ---------------- */
+// Returns the position of the k-th (0 based) set bit of `word`, k must be < popcount(word)
+static inline constexpr
+isize _select_in_word(u64 word, isize k){
+#if defined(__BMI2__)
+	if(!std::is_constant_evaluated()){
+		return std::countr_zero(_pdep_u64(u64(1) << k, word));
+	}
+#endif
+	for(isize i = 0; i < k; i++){
+		word &= word - 1;
+	}
+	return std::countr_zero(word);
+}
+
+// Runtime sized bit set, uses the same layout as Bit_Vec (bits past len() in
+// the last word are always 0). rank() and select() use a directory with the
+// number of set bits before every 512 bit block, it is rebuilt lazily after
+// the set is modified.
+struct Dynamic_Bit_Set {
+	static constexpr isize rank_block_words = 8;
+	static constexpr isize simd_words = max(isize(1), _vec_native::max_width / isize(sizeof(u64)));
+
+	u64* data = nullptr;
+	isize length = 0;   /* In bits */
+	isize capacity = 0; /* In words */
+	u64* rank_index = nullptr;
+	isize rank_index_len = 0;
+	bool rank_dirty = true;
+	mem::Allocator allocator;
+
+	auto len() const { return length; }
+
+	auto word_len() const { return (length + 63) / 64; }
+
+	// Zero-copy view of the underlying words
+	slice<u64> words(){
+		return slice<u64>::from(data, word_len());
+	}
+
+	bool get(isize idx) const {
+		bounds_check(idx >= 0 && idx < length, "Out of bounds access to bit set");
+		return (data[idx / 64] >> (idx % 64)) & 1;
+	}
+
+	void set(isize idx, bool val){
+		bounds_check(idx >= 0 && idx < length, "Out of bounds access to bit set");
+		u64 bit = u64(1) << (idx % 64);
+		if(val){
+			data[idx / 64] |= bit;
+		} else {
+			data[idx / 64] &= ~bit;
+		}
+		rank_dirty = true;
+	}
+
+	// Set every bit to `val`
+	void fill(bool val){
+		mem::set(data, val ? 0xff : 0x00, word_len() * sizeof(u64));
+		_clear_tail();
+		rank_dirty = true;
+	}
+
+	// Change length in bits, new bits are 0. On allocation failure the set is
+	// left untouched and the error is returned.
+	mem::Allocator_Error resize(isize new_len){
+		isize new_words = (new_len + 63) / 64;
+		if(new_words > capacity){
+			auto err = _reserve(new_words);
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		if(new_len > length){
+			isize old_words = word_len();
+			_clear_tail();
+			mem::set(&data[old_words], 0, (new_words - old_words) * sizeof(u64));
+		}
+		length = new_len;
+		_clear_tail();
+		rank_dirty = true;
+		return mem::Allocator_Error::none;
+	}
+
+	mem::Allocator_Error append(bool val){
+		if(length >= capacity * 64){
+			auto err = _reserve(max(isize(4), capacity * 2));
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		if(length % 64 == 0){
+			data[length / 64] = 0;
+		}
+		length += 1;
+		set(length - 1, val);
+		return mem::Allocator_Error::none;
+	}
+
+	isize count() const {
+		isize total = 0;
+		for(isize i = 0; i < word_len(); i++){
+			total += std::popcount(data[i]);
+		}
+		return total;
+	}
+
+	bool any() const {
+		return _find_set_bit(data, word_len(), 0) >= 0;
+	}
+
+	bool none() const {
+		return !any();
+	}
+
+	// Index of the first set bit, -1 if there's none
+	isize find_first_set() const {
+		return _find_set_bit(data, word_len(), 0);
+	}
+
+	// Index of the first set bit after `idx`, -1 if there's none
+	isize find_next_set(isize idx) const {
+		return _find_set_bit(data, word_len(), idx + 1);
+	}
+
+	// Iterate over indices of set bits: for(isize i : bits.set_bits()){ ... }
+	auto set_bits() const {
+		return cpp_iter::Set_Bit_Range{data, word_len()};
+	}
+
+	/* Bulk operations, applied to bits [0, min(len(), other.len())). Bits at
+	   or past other.len() are left untouched, also for bitwise_and(). */
+	void bitwise_and(Dynamic_Bit_Set const& other){
+		_apply(other, [](auto a, auto b){ return a & b; });
+	}
+
+	void bitwise_or(Dynamic_Bit_Set const& other){
+		_apply(other, [](auto a, auto b){ return a | b; });
+	}
+
+	void bitwise_xor(Dynamic_Bit_Set const& other){
+		_apply(other, [](auto a, auto b){ return a ^ b; });
+	}
+
+	// this = this & ~other
+	void bitwise_and_not(Dynamic_Bit_Set const& other){
+		_apply(other, [](auto a, auto b){ return a & ~b; });
+	}
+
+	// Number of set bits in [0, idx)
+	isize rank(isize idx){
+		bounds_check(idx >= 0 && idx <= length, "Out of bounds rank");
+		_build_rank_index();
+		isize w = idx / 64;
+		isize block = w / rank_block_words;
+		isize total = rank_index[block];
+		for(isize i = block * rank_block_words; i < w; i++){
+			total += std::popcount(data[i]);
+		}
+		if(idx % 64 != 0){
+			total += std::popcount(data[w] & ((u64(1) << (idx % 64)) - 1));
+		}
+		return total;
+	}
+
+	// Position of the k-th (0 based) set bit, -1 if there are k or fewer set bits
+	isize select(isize k){
+		_build_rank_index();
+		if(k < 0 || u64(k) >= rank_index[rank_index_len - 1]){ return -1; }
+
+		/* Last block that starts with at most k bits set before it */
+		isize lo = 0, hi = rank_index_len - 1;
+		while(hi - lo > 1){
+			isize mid = lo + (hi - lo) / 2;
+			if(rank_index[mid] <= u64(k)){ lo = mid; } else { hi = mid; }
+		}
+
+		k -= rank_index[lo];
+		for(isize w = lo * rank_block_words; w < word_len(); w++){
+			isize n = std::popcount(data[w]);
+			if(k < n){
+				return w * 64 + _select_in_word(data[w], k);
+			}
+			k -= n;
+		}
+		return -1;
+	}
+
+	static Dynamic_Bit_Set from(mem::Allocator allocator, isize bit_count = 0){
+		Dynamic_Bit_Set set;
+		set.allocator = allocator;
+		(void)set.resize(bit_count);
+		return set;
+	}
+
+	void destroy(){
+		allocator.free(data, capacity * sizeof(u64));
+		allocator.free(rank_index, rank_index_len * sizeof(u64));
+		data = nullptr;
+		rank_index = nullptr;
+		length = 0;
+		capacity = 0;
+		rank_index_len = 0;
+		rank_dirty = true;
+	}
+
+	mem::Allocator_Error _reserve(isize new_cap){
+		void* new_data = allocator.resize((void*)data, new_cap * sizeof(u64), capacity * sizeof(u64));
+		if(new_data == nullptr){
+			auto res = allocator.try_alloc_non_zero(new_cap * sizeof(u64), alignof(u64));
+			if(!res.ok()){ return res.unwrap_err(); }
+			new_data = res.unwrap();
+			if(data != nullptr){
+				mem::copy(new_data, data, word_len() * sizeof(u64));
+				allocator.free(data, capacity * sizeof(u64));
+			}
+		}
+		data = (u64*)new_data;
+		capacity = new_cap;
+		return mem::Allocator_Error::none;
+	}
+
+	void _clear_tail(){
+		if(length % 64 != 0){
+			data[length / 64] &= (u64(1) << (length % 64)) - 1;
+		}
+	}
+
+	template<typename F>
+	void _apply(Dynamic_Bit_Set const& other, F op){
+		using Block = vec<u64, simd_words>;
+		isize n = min(word_len(), other.length / 64);
+		isize i = 0;
+		for(; i + simd_words <= n; i += simd_words){
+			auto& dst = *(Block*)&data[i];
+			dst = op(dst, *(Block const*)&other.data[i]);
+		}
+		for(; i < n; i++){
+			data[i] = op(data[i], other.data[i]);
+		}
+		/* Partial last word of `other`: only its low bits take part */
+		if(other.length % 64 != 0 && n < word_len()){
+			u64 mask = (u64(1) << (other.length % 64)) - 1;
+			data[n] = (op(data[n], other.data[n]) & mask) | (data[n] & ~mask);
+		}
+		_clear_tail();
+		rank_dirty = true;
+	}
+
+	// rank_index[b] = set bits before block b, the extra last entry holds count()
+	void _build_rank_index(){
+		if(!rank_dirty){ return; }
+		isize blocks = (word_len() + rank_block_words - 1) / rank_block_words;
+		if(blocks + 1 > rank_index_len){
+			allocator.free(rank_index, rank_index_len * sizeof(u64));
+			rank_index = (u64*)allocator.alloc((blocks + 1) * sizeof(u64), alignof(u64));
+			rank_index_len = blocks + 1;
+		}
+
+		u64 total = 0;
+		for(isize b = 0; b < blocks; b++){
+			rank_index[b] = total;
+			isize end = min((b + 1) * rank_block_words, word_len());
+			for(isize w = b * rank_block_words; w < end; w++){
+				total += std::popcount(data[w]);
+			}
+		}
+		for(isize b = blocks; b < rank_index_len; b++){
+			rank_index[b] = total;
+		}
+		rank_dirty = false;
+	}
+};
+
+/* ---------------- Roaring Bitmap ---------------- */
+// Compressed set of u32. The high 16 bits of a value select a container, the
+// low 16 bits are stored in it. Containers hold a sorted array of u16 while
+// they have at most `array_max` values (8 KiB, the size of a full bitmap),
+// past that they are converted to a Bit_Vec<65536>.
+//
+// Serialized layout (native endianness):
+//   u32 container_count
+//   container_count x { u16 key, u16 kind (0: array, 1: bitmap), u32 cardinality }
+//   payloads in the same order: cardinality x u16 for arrays, 1024 x u64 for bitmaps
+struct Roaring_Bitmap {
+	static constexpr isize array_max = 4096;
+	static constexpr isize simd_words = max(isize(1), _vec_native::max_width / isize(sizeof(u64)));
+	using Bitmap = Bit_Vec<65536>;
+
+	struct Container {
+		u16 key;
+		isize cardinality;
+		Dynamic_Array<u16> array;  /* Used when bitmap is null */
+		Bitmap* bitmap;
+	};
+
+	Dynamic_Array<Container> containers;
+	mem::Allocator allocator;
+
+	isize cardinality() const {
+		isize total = 0;
+		for(isize i = 0; i < containers.len(); i++){
+			total += containers[i].cardinality;
+		}
+		return total;
+	}
+
+	bool contains(u32 value) const {
+		auto [idx, found] = _find(u16(value >> 16));
+		if(!found){ return false; }
+		auto const& c = containers[idx];
+		u16 low = u16(value);
+		if(c.bitmap){
+			return c.bitmap->get(low);
+		}
+		return _array_find(c.array, low).second;
+	}
+
+	// On allocation failure the bitmap is left unchanged and the error is returned
+	mem::Allocator_Error add(u32 value){
+		u16 high = u16(value >> 16);
+		u16 low = u16(value);
+		auto [idx, found] = _find(high);
+		if(!found){
+			/* Fill the container before inserting it, so a failure leaves no empty container */
+			Container c = {high, 1, Dynamic_Array<u16>::from(allocator, 0), nullptr};
+			auto err = c.array.append(low);
+			if(err == mem::Allocator_Error::none){
+				err = containers.insert(idx, c);
+			}
+			if(err != mem::Allocator_Error::none){
+				c.array.destroy();
+			}
+			return err;
+		}
+
+		auto& c = containers[idx];
+		if(c.bitmap){
+			if(!c.bitmap->get(low)){
+				c.bitmap->set(low, true);
+				c.cardinality += 1;
+			}
+			return mem::Allocator_Error::none;
+		}
+
+		auto [pos, present] = _array_find(c.array, low);
+		if(present){ return mem::Allocator_Error::none; }
+		if(c.cardinality >= array_max){
+			auto err = _to_bitmap(c);
+			if(err != mem::Allocator_Error::none){ return err; }
+			c.bitmap->set(low, true);
+		}
+		else {
+			auto err = c.array.insert(pos, low);
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		c.cardinality += 1;
+		return mem::Allocator_Error::none;
+	}
+
+	void remove(u32 value){
+		auto [idx, found] = _find(u16(value >> 16));
+		if(!found){ return; }
+
+		auto& c = containers[idx];
+		u16 low = u16(value);
+		if(c.bitmap){
+			if(!c.bitmap->get(low)){ return; }
+			c.bitmap->set(low, false);
+			c.cardinality -= 1;
+			if(c.cardinality <= array_max){
+				/* If this fails the container just stays a bitmap, which is still valid */
+				(void)_to_array(c);
+			}
+		}
+		else {
+			auto [pos, present] = _array_find(c.array, low);
+			if(!present){ return; }
+			mem::copy(&c.array.data[pos], &c.array.data[pos + 1], (c.array.length - pos - 1) * sizeof(u16));
+			c.array.length -= 1;
+			c.cardinality -= 1;
+		}
+
+		if(c.cardinality == 0){
+			_destroy_container(c);
+			mem::copy(&containers.data[idx], &containers.data[idx + 1], (containers.length - idx - 1) * sizeof(Container));
+			containers.length -= 1;
+		}
+	}
+
+	// Call `f(u32)` for each value, in ascending order
+	template<typename F>
+	void for_each(F f) const {
+		for(isize i = 0; i < containers.len(); i++){
+			auto const& c = containers[i];
+			u32 high = u32(c.key) << 16;
+			if(c.bitmap){
+				for(isize low : c.bitmap->set_bits()){
+					f(high | u32(low));
+				}
+			}
+			else {
+				for(isize j = 0; j < c.array.len(); j++){
+					f(high | c.array[j]);
+				}
+			}
+		}
+	}
+
+	static Roaring_Bitmap from(mem::Allocator allocator){
+		Roaring_Bitmap r;
+		r.allocator = allocator;
+		r.containers = Dynamic_Array<Container>::from(allocator);
+		return r;
+	}
+
+	// Union of two bitmaps, allocated with `allocator`. On allocation failure
+	// nothing is leaked and the error is returned.
+	static Result<Roaring_Bitmap, mem::Allocator_Error> unite(Roaring_Bitmap const& a, Roaring_Bitmap const& b, mem::Allocator allocator){
+		auto r = from(allocator);
+		isize i = 0, j = 0;
+		while(i < a.containers.len() || j < b.containers.len()){
+			auto err = mem::Allocator_Error::none;
+			if(j >= b.containers.len() || (i < a.containers.len() && a.containers[i].key < b.containers[j].key)){
+				err = r._push(r._clone(a.containers[i]));
+				i += 1;
+			}
+			else if(i >= a.containers.len() || b.containers[j].key < a.containers[i].key){
+				err = r._push(r._clone(b.containers[j]));
+				j += 1;
+			}
+			else {
+				err = r._push(r._unite(a.containers[i], b.containers[j]));
+				i += 1;
+				j += 1;
+			}
+			if(err != mem::Allocator_Error::none){
+				r.destroy();
+				return err;
+			}
+		}
+		return r;
+	}
+
+	// Intersection of two bitmaps, allocated with `allocator`. On allocation
+	// failure nothing is leaked and the error is returned.
+	static Result<Roaring_Bitmap, mem::Allocator_Error> intersect(Roaring_Bitmap const& a, Roaring_Bitmap const& b, mem::Allocator allocator){
+		auto r = from(allocator);
+		isize i = 0, j = 0;
+		while(i < a.containers.len() && j < b.containers.len()){
+			u16 ka = a.containers[i].key, kb = b.containers[j].key;
+			if(ka < kb){ i += 1; continue; }
+			if(kb < ka){ j += 1; continue; }
+
+			auto err = r._push(r._intersect(a.containers[i], b.containers[j]));
+			if(err != mem::Allocator_Error::none){
+				r.destroy();
+				return err;
+			}
+			i += 1;
+			j += 1;
+		}
+		return r;
+	}
+
+	isize serialized_size() const {
+		isize size = sizeof(u32) + containers.len() * (2 * sizeof(u16) + sizeof(u32));
+		for(isize i = 0; i < containers.len(); i++){
+			auto const& c = containers[i];
+			size += c.bitmap ? isize(sizeof(Bitmap)) : c.cardinality * isize(sizeof(u16));
+		}
+		return size;
+	}
+
+	// Write bitmap into `out`, returns number of bytes written or -1 if `out` is too small
+	isize serialize(slice<byte> out) const {
+		if(out.len() < serialized_size()){ return -1; }
+		byte* dst = out.raw_data();
+		isize off = 0;
+		auto put = [&](void const* p, isize n){
+			mem::copy_no_overlap(&dst[off], p, n);
+			off += n;
+		};
+
+		u32 count = containers.len();
+		put(&count, sizeof(count));
+		for(isize i = 0; i < containers.len(); i++){
+			auto const& c = containers[i];
+			u16 kind = c.bitmap ? 1 : 0;
+			u32 card = c.cardinality;
+			put(&c.key, sizeof(c.key));
+			put(&kind, sizeof(kind));
+			put(&card, sizeof(card));
+		}
+		for(isize i = 0; i < containers.len(); i++){
+			auto const& c = containers[i];
+			if(c.bitmap){
+				put(c.bitmap, sizeof(Bitmap));
+			} else {
+				put(c.array.data, c.cardinality * sizeof(u16));
+			}
+		}
+		return off;
+	}
+
+	// Read bitmap produced by serialize(), empty on malformed input or if
+	// allocation fails
+	static Option<Roaring_Bitmap> deserialize(mem::Allocator allocator, slice<byte> in){
+		byte const* src = in.raw_data();
+		isize off = 0;
+		auto get = [&](void* p, isize n){
+			if(off + n > in.len()){ return false; }
+			mem::copy_no_overlap(p, &src[off], n);
+			off += n;
+			return true;
+		};
+
+		u32 count = 0;
+		if(!get(&count, sizeof(count))){ return {}; }
+		isize headers = off;
+		isize header_size = 2 * sizeof(u16) + sizeof(u32);
+		if(isize(count) * header_size > in.len() - off){ return {}; }
+		off += count * header_size;
+
+		auto r = from(allocator);
+		bool ok = true;
+		for(u32 i = 0; i < count && ok; i++){
+			u16 key = 0, kind = 0;
+			u32 card = 0;
+			isize payload = off;
+			off = headers + i * header_size;
+			get(&key, sizeof(key));
+			get(&kind, sizeof(kind));
+			get(&card, sizeof(card));
+			off = payload;
+
+			bool sorted = r.containers.len() == 0 || r.containers[r.containers.len() - 1].key < key;
+			if(!sorted || kind > 1 || card == 0 || card > 65536 || (kind == 0 && card > array_max)){
+				ok = false;
+				break;
+			}
+
+			auto made = kind == 1 ? r._make_bitmap(key) : r._make_array(key, card);
+			if(!made.ok()){
+				ok = false;
+				break;
+			}
+			Container c = made.unwrap();
+			if(kind == 1){
+				ok = get(c.bitmap, sizeof(Bitmap));
+				c.cardinality = c.bitmap->count();
+				ok = ok && c.cardinality == isize(card);
+			}
+			else {
+				c.cardinality = card;
+				c.array.length = card;
+				ok = get(c.array.data, card * sizeof(u16));
+				for(u32 k = 1; ok && k < card; k++){
+					ok = c.array.data[k - 1] < c.array.data[k];
+				}
+			}
+			if(r.containers.append(c) != mem::Allocator_Error::none){
+				r._destroy_container(c);
+				ok = false;
+			}
+		}
+
+		if(!ok){
+			r.destroy();
+			return {};
+		}
+		return r;
+	}
+
+	void destroy(){
+		for(isize i = 0; i < containers.len(); i++){
+			_destroy_container(containers[i]);
+		}
+		containers.destroy();
+		containers.length = 0;
+	}
+
+	/* Internals */
+	// Index of container with `key`, or the index it should be inserted at
+	pair<isize, bool> _find(u16 key) const {
+		isize lo = 0, hi = containers.len();
+		while(lo < hi){
+			isize mid = lo + (hi - lo) / 2;
+			if(containers[mid].key < key){ lo = mid + 1; } else { hi = mid; }
+		}
+		return {lo, lo < containers.len() && containers[lo].key == key};
+	}
+
+	static pair<isize, bool> _array_find(Dynamic_Array<u16> const& arr, u16 val){
+		isize lo = 0, hi = arr.len();
+		while(lo < hi){
+			isize mid = lo + (hi - lo) / 2;
+			if(arr.data[mid] < val){ lo = mid + 1; } else { hi = mid; }
+		}
+		return {lo, lo < arr.len() && arr.data[lo] == val};
+	}
+
+	// Empty array container with room for `cap` values
+	Result<Container, mem::Allocator_Error> _make_array(u16 key, isize cap){
+		cap = max(cap, isize(1));
+		auto res = allocator.try_alloc_non_zero(cap * sizeof(u16), alignof(u16));
+		if(!res.ok()){ return res.unwrap_err(); }
+		auto arr = Dynamic_Array<u16>::from(allocator, 0);
+		arr.data = (u16*)res.unwrap();
+		arr.capacity = cap;
+		return Container{key, 0, arr, nullptr};
+	}
+
+	// Empty (zeroed) bitmap container
+	Result<Container, mem::Allocator_Error> _make_bitmap(u16 key){
+		auto res = allocator.try_alloc(sizeof(Bitmap), alignof(Bitmap));
+		if(!res.ok()){ return res.unwrap_err(); }
+		return Container{key, 0, {}, (Bitmap*)res.unwrap()};
+	}
+
+	// Append a container built by the set operations, dropping empty ones.
+	// The container is released if it can't be appended.
+	mem::Allocator_Error _push(Result<Container, mem::Allocator_Error> made){
+		if(!made.ok()){ return made.unwrap_err(); }
+		Container c = made.unwrap();
+		if(c.cardinality == 0){
+			_destroy_container(c);
+			return mem::Allocator_Error::none;
+		}
+		auto err = containers.append(c);
+		if(err != mem::Allocator_Error::none){
+			_destroy_container(c);
+		}
+		return err;
+	}
+
+	void _destroy_container(Container& c){
+		if(c.bitmap){
+			allocator.destroy(c.bitmap);
+			c.bitmap = nullptr;
+		} else {
+			c.array.destroy();
+		}
+	}
+
+	// Leaves `c` unchanged on failure
+	mem::Allocator_Error _to_bitmap(Container& c){
+		auto made = _make_bitmap(c.key);
+		if(!made.ok()){ return made.unwrap_err(); }
+		auto bitmap = made.unwrap().bitmap;
+		for(isize i = 0; i < c.array.len(); i++){
+			bitmap->set(c.array.data[i], true);
+		}
+		c.array.destroy();
+		c.array = {};
+		c.bitmap = bitmap;
+		return mem::Allocator_Error::none;
+	}
+
+	// Leaves `c` unchanged on failure
+	mem::Allocator_Error _to_array(Container& c){
+		auto made = _make_array(c.key, c.cardinality);
+		if(!made.ok()){ return made.unwrap_err(); }
+		auto arr = made.unwrap().array;
+		for(isize low : c.bitmap->set_bits()){
+			arr.data[arr.length] = u16(low);
+			arr.length += 1;
+		}
+		allocator.destroy(c.bitmap);
+		c.bitmap = nullptr;
+		c.array = arr;
+		return mem::Allocator_Error::none;
+	}
+
+	Result<Container, mem::Allocator_Error> _clone(Container const& c){
+		auto made = c.bitmap ? _make_bitmap(c.key) : _make_array(c.key, c.cardinality);
+		if(!made.ok()){ return made; }
+		Container res = made.unwrap();
+		if(c.bitmap){
+			*res.bitmap = *c.bitmap;
+		} else {
+			mem::copy_no_overlap(res.array.data, c.array.data, c.cardinality * sizeof(u16));
+			res.array.length = c.cardinality;
+		}
+		res.cardinality = c.cardinality;
+		return res;
+	}
+
+	// dst = a op b over whole bitmaps, returns the cardinality of the result
+	template<typename F>
+	static isize _bitmap_op(Bitmap* dst, Bitmap const& a, Bitmap const& b, F op){
+		using Block = vec<u64, simd_words>;
+		isize card = 0;
+		for(isize i = 0; i < Bitmap::word_count; i += simd_words){
+			Block r = op(*(Block const*)&a.data[i], *(Block const*)&b.data[i]);
+			*(Block*)&dst->data[i] = r;
+			for(isize k = 0; k < simd_words; k++){
+				card += std::popcount(r[k]);
+			}
+		}
+		return card;
+	}
+
+	Result<Container, mem::Allocator_Error> _unite(Container const& a, Container const& b){
+		if(a.bitmap && b.bitmap){
+			auto made = _make_bitmap(a.key);
+			if(!made.ok()){ return made; }
+			Container res = made.unwrap();
+			res.cardinality = _bitmap_op(res.bitmap, *a.bitmap, *b.bitmap, [](auto x, auto y){ return x | y; });
+			return res;
+		}
+		if(a.bitmap || b.bitmap){
+			auto const& bm = a.bitmap ? a : b;
+			auto const& arr = a.bitmap ? b : a;
+			auto made = _clone(bm);
+			if(!made.ok()){ return made; }
+			Container res = made.unwrap();
+			for(isize i = 0; i < arr.array.len(); i++){
+				u16 v = arr.array.data[i];
+				res.cardinality += !res.bitmap->get(v);
+				res.bitmap->set(v, true);
+			}
+			return res;
+		}
+
+		/* Sorted merge of two arrays */
+		auto made = _make_array(a.key, a.cardinality + b.cardinality);
+		if(!made.ok()){ return made; }
+		Container res = made.unwrap();
+		u16 const* x = a.array.data;
+		u16 const* y = b.array.data;
+		u16* out = res.array.data;
+		isize i = 0, j = 0, n = 0;
+		while(i < a.cardinality && j < b.cardinality){
+			u16 vx = x[i], vy = y[j];
+			out[n] = min(vx, vy);
+			n += 1;
+			i += vx <= vy;
+			j += vy <= vx;
+		}
+		for(; i < a.cardinality; i++){ out[n] = x[i]; n += 1; }
+		for(; j < b.cardinality; j++){ out[n] = y[j]; n += 1; }
+		res.array.length = n;
+		res.cardinality = n;
+		if(n > array_max){
+			/* An oversized array is still valid if this fails */
+			(void)_to_bitmap(res);
+		}
+		return res;
+	}
+
+	Result<Container, mem::Allocator_Error> _intersect(Container const& a, Container const& b){
+		if(a.bitmap && b.bitmap){
+			auto made = _make_bitmap(a.key);
+			if(!made.ok()){ return made; }
+			Container res = made.unwrap();
+			res.cardinality = _bitmap_op(res.bitmap, *a.bitmap, *b.bitmap, [](auto x, auto y){ return x & y; });
+			if(res.cardinality <= array_max){
+				(void)_to_array(res);
+			}
+			return res;
+		}
+		if(a.bitmap || b.bitmap){
+			auto const& bm = a.bitmap ? a : b;
+			auto const& arr = a.bitmap ? b : a;
+			auto made = _make_array(a.key, arr.cardinality);
+			if(!made.ok()){ return made; }
+			Container res = made.unwrap();
+			isize n = 0;
+			for(isize i = 0; i < arr.cardinality; i++){
+				u16 v = arr.array.data[i];
+				res.array.data[n] = v;
+				n += bm.bitmap->get(v);
+			}
+			res.array.length = n;
+			res.cardinality = n;
+			return res;
+		}
+
+		/* Sorted merge of two arrays */
+		auto made = _make_array(a.key, min(a.cardinality, b.cardinality));
+		if(!made.ok()){ return made; }
+		Container res = made.unwrap();
+		u16 const* x = a.array.data;
+		u16 const* y = b.array.data;
+		u16* out = res.array.data;
+		isize i = 0, j = 0, n = 0;
+		while(i < a.cardinality && j < b.cardinality){
+			u16 vx = x[i], vy = y[j];
+			out[n] = vx;
+			n += vx == vy;
+			i += vx <= vy;
+			j += vy <= vx;
+		}
+		res.array.length = n;
+		res.cardinality = n;
+		return res;
+	}
+};
+
+/* ---------------- Tracing ---------------- */
+// Scoped timing zones, exported as Chrome Trace Event JSON (chrome://tracing,
+// ui.perfetto.dev). Only compiled in when ENABLE_TRACING is defined, otherwise
+// trace_zone() expands to nothing.
+//
+//     void update(){
+//         trace_zone("update");
+//         ...
+//     }
+//
+// Each thread records into its own ring buffer, which is written only by that
+// thread and drained by flush(), so recording is lock-free. When a ring is full
+// new events are dropped and counted. Buffers of exited threads are handed to
+// new threads, which then show up under the same tid.
+namespace trace {
+#ifdef ENABLE_TRACING
+constexpr inline isize ring_size = 8192;
+static_assert(mem::valid_alignment(ring_size), "Ring size must be a power of 2");
+
+struct Event {
+	cstring name;
+	Source_Location location;
+	u64 begin;
+	u64 end;
+};
+
+struct Thread_Buffer {
+	Event events[ring_size];
+	std::atomic<u64> head = 0; /* Written by owning thread */
+	std::atomic<u64> tail = 0; /* Written by flush() */
+	std::atomic<u64> dropped = 0;
+	std::atomic<bool> in_use = true; /* Cleared when the owning thread exits */
+	u32 thread_id = 0;
+	Thread_Buffer* next = nullptr;
+};
+
+inline std::atomic<Thread_Buffer*> _buffers = nullptr;
+inline std::atomic<u32> _thread_count = 0;
+inline u64 _epoch = temporal::Cycle_Counter::now();
+inline atomic::Spinlock _flush_lock;
+inline thread_local Thread_Buffer* _local_buffer = nullptr;
+
+struct _Thread_Exit {
+	~_Thread_Exit(){
+		if(_local_buffer == nullptr){ return; }
+		atomic::store(&_local_buffer->in_use, false, atomic::Memory_Order::release);
+		_local_buffer = nullptr;
+	}
+};
+inline thread_local _Thread_Exit _thread_exit;
+
+// Buffers stay on the list for good (flush() walks it without locking), a
+// released one is claimed before allocating. Returns null if allocation fails.
+static inline
+Thread_Buffer* _register_thread(){
+	(void)&_thread_exit; /* Constructs it, so the buffer is released on exit */
+
+	for(Thread_Buffer* b = atomic::load(&_buffers, atomic::Memory_Order::acquire); b != nullptr; b = b->next){
+		bool expected = false;
+		if(!atomic::load(&b->in_use, atomic::Memory_Order::relaxed) &&
+		   atomic::compare_exchange_strong(&b->in_use, &expected, true, atomic::Memory_Order::acquire)){
+			_local_buffer = b;
+			return b;
+		}
+	}
+
+	auto res = mem::heap_allocator().try_alloc_non_zero(sizeof(Thread_Buffer), alignof(Thread_Buffer));
+	if(!res.ok()){ return nullptr; }
+	auto buf = new (res.unwrap()) Thread_Buffer;
+	buf->thread_id = atomic::fetch_add(&_thread_count, u32(1), atomic::Memory_Order::relaxed) + 1;
+
+	Thread_Buffer* head = atomic::load(&_buffers, atomic::Memory_Order::relaxed);
+	do {
+		buf->next = head;
+	} while(!atomic::compare_exchange_weak(&_buffers, &head, buf, atomic::Memory_Order::release));
+
+	_local_buffer = buf;
+	return buf;
+}
+
+static inline
+void record(cstring name, Source_Location const& location, u64 begin, u64 end){
+	Thread_Buffer* buf = _local_buffer;
+	[[unlikely]] if(buf == nullptr){
+		buf = _register_thread();
+		if(buf == nullptr){ return; }
+	}
+
+	u64 head = atomic::load(&buf->head, atomic::Memory_Order::relaxed);
+	u64 tail = atomic::load(&buf->tail, atomic::Memory_Order::acquire);
+	if(head - tail >= u64(ring_size)){
+		atomic::fetch_add(&buf->dropped, u64(1), atomic::Memory_Order::relaxed);
+		return;
+	}
+
+	buf->events[head & (ring_size - 1)] = {name, location, begin, end};
+	atomic::store(&buf->head, head + 1, atomic::Memory_Order::release);
+}
+
+struct Zone {
+	cstring name;
+	Source_Location location;
+	u64 begin;
+
+	Zone(cstring name, caller_location) : name(name), location(source_location) {
+		begin = temporal::Cycle_Counter::now();
+	}
+
+	~Zone(){
+		record(name, location, begin, temporal::Cycle_Counter::now());
+	}
+
+	Zone(Zone const&) = delete;
+	void operator=(Zone const&) = delete;
+};
+
+#define trace_zone(Name) ::trace::Zone _defer_var(_trace_zone_)(Name)
+
+static inline
+mem::Allocator_Error _append(Dynamic_Array<byte>* out, cstring s, isize n){
+	for(isize i = 0; i < n; i++){
+		auto err = out->append(byte(s[i]));
+		if(err != mem::Allocator_Error::none){ return err; }
+	}
+	return mem::Allocator_Error::none;
+}
+
+static inline
+mem::Allocator_Error _append_json_string(Dynamic_Array<byte>* out, cstring s){
+	auto err = out->append('"');
+	for(isize i = 0; s[i] != 0 && err == mem::Allocator_Error::none; i++){
+		char c = s[i];
+		if(c == '"' || c == '\\'){
+			char esc[2] = {'\\', c};
+			err = _append(out, esc, 2);
+		}
+		else if(u8(c) < 0x20){
+			char esc[8];
+			int n = snprintf(esc, sizeof(esc), "\\u%04x", c);
+			err = _append(out, esc, n);
+		}
+		else {
+			err = out->append(byte(c));
+		}
+	}
+	if(err != mem::Allocator_Error::none){ return err; }
+	return out->append('"');
+}
+
+// Drain all thread buffers and append a Chrome Trace Event JSON document to
+// `out`. Events recorded while flushing are kept for the next flush. If `out`
+// fails to grow the document is truncated, the drained events are lost and
+// the first error is returned.
+static inline
+mem::Allocator_Error flush(Dynamic_Array<byte>* out){
+	_flush_lock.acquire();
+	defer(_flush_lock.release());
+
+	f64 us_per_tick = temporal::Cycle_Counter::nanoseconds_per_tick() / 1000.0;
+	char num[128];
+	bool first = true;
+	u64 dropped = 0;
+	auto err = mem::Allocator_Error::none;
+	auto put = [&](mem::Allocator_Error e){
+		if(err == mem::Allocator_Error::none){ err = e; }
+	};
+
+	cstring header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	put(_append(out, header, cstring_len(header)));
+
+	for(auto buf = atomic::load(&_buffers, atomic::Memory_Order::acquire); buf != nullptr; buf = buf->next){
+		u64 tail = atomic::load(&buf->tail, atomic::Memory_Order::relaxed);
+		u64 head = atomic::load(&buf->head, atomic::Memory_Order::acquire);
+		dropped += atomic::exchange(&buf->dropped, u64(0), atomic::Memory_Order::relaxed);
+
+		for(u64 i = tail; i < head && err == mem::Allocator_Error::none; i++){
+			Event const& e = buf->events[i & (ring_size - 1)];
+			if(!first){ put(out->append(',')); }
+			first = false;
+
+			cstring name_key = "{\"ph\":\"X\",\"pid\":1,\"name\":";
+			put(_append(out, name_key, cstring_len(name_key)));
+			put(_append_json_string(out, e.name));
+
+			int n = snprintf(num, sizeof(num), ",\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"file\":",
+				buf->thread_id, f64(e.begin - _epoch) * us_per_tick, f64(e.end - e.begin) * us_per_tick);
+			put(_append(out, num, n));
+			put(_append_json_string(out, e.location.file_name()));
+
+			n = snprintf(num, sizeof(num), ",\"line\":%u}}", unsigned(e.location.line()));
+			put(_append(out, num, n));
+		}
+		atomic::store(&buf->tail, head, atomic::Memory_Order::release);
+	}
+
+	int n = snprintf(num, sizeof(num), "],\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)dropped);
+	put(_append(out, num, n));
+	return err;
+}
+#else
+#define trace_zone(Name)
+
+static inline
+mem::Allocator_Error flush(Dynamic_Array<byte>* out){
+	cstring empty = "{\"traceEvents\":[]}\n";
+	for(isize i = 0; empty[i] != 0; i++){
+		auto err = out->append(byte(empty[i]));
+		if(err != mem::Allocator_Error::none){ return err; }
+	}
+	return mem::Allocator_Error::none;
+}
+#endif
+}
+
+/* ---------------- Latency Histogram ---------------- */
+namespace temporal {
+// Fixed size, log-linear histogram of durations (HDR histogram style). Values
+// below 2^sub_bucket_bits ns are counted exactly, above that each power of two
+// is split into 2^sub_bucket_bits buckets, giving ~3% worst case relative
+// error on percentiles across the whole i64 nanosecond range.
+//
+// record() is for a single writer (plain relaxed load + store), record_atomic()
+// may be called concurrently from any number of threads. Per-thread histograms
+// can also be combined with merge().
+struct Latency_Histogram {
+	static constexpr int sub_bucket_bits = 5;
+	static constexpr isize sub_bucket_count = isize(1) << sub_bucket_bits;
+	static constexpr isize bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+	std::atomic<u64> counts[bucket_count] = {};
+	std::atomic<u64> total = 0;
+	std::atomic<u64> sum_ns = 0;
+	std::atomic<u64> min_ns = ~u64(0);
+	std::atomic<u64> max_ns = 0;
+
+	static constexpr isize bucket_index(u64 v){
+		if(v < u64(sub_bucket_count)){
+			return isize(v);
+		}
+		int msb = 63 - std::countl_zero(v);
+		u64 top = v >> (msb - sub_bucket_bits);
+		return isize(msb - sub_bucket_bits + 1) * sub_bucket_count + isize(top) - sub_bucket_count;
+	}
+
+	// Largest value that maps to bucket `idx`
+	static constexpr u64 bucket_upper_bound(isize idx){
+		if(idx < sub_bucket_count){
+			return u64(idx);
+		}
+		isize group = idx / sub_bucket_count;
+		u64 top = u64(sub_bucket_count + idx % sub_bucket_count);
+		return (top << (group - 1)) + ((u64(1) << (group - 1)) - 1);
+	}
+
+	void record(Duration d){
+		using atomic::Memory_Order;
+		u64 v = u64(::max(d.count_nanoseconds(), i64(0)));
+		auto& bucket = counts[bucket_index(v)];
+		atomic::store(&bucket, atomic::load(&bucket, Memory_Order::relaxed) + 1, Memory_Order::relaxed);
+		atomic::store(&total, atomic::load(&total, Memory_Order::relaxed) + 1, Memory_Order::relaxed);
+		atomic::store(&sum_ns, atomic::load(&sum_ns, Memory_Order::relaxed) + v, Memory_Order::relaxed);
+		if(v < atomic::load(&min_ns, Memory_Order::relaxed)){
+			atomic::store(&min_ns, v, Memory_Order::relaxed);
+		}
+		if(v > atomic::load(&max_ns, Memory_Order::relaxed)){
+			atomic::store(&max_ns, v, Memory_Order::relaxed);
+		}
+	}
+
+	void record_atomic(Duration d){
+		using atomic::Memory_Order;
+		u64 v = u64(::max(d.count_nanoseconds(), i64(0)));
+		atomic::fetch_add(&counts[bucket_index(v)], u64(1), Memory_Order::relaxed);
+		atomic::fetch_add(&total, u64(1), Memory_Order::relaxed);
+		atomic::fetch_add(&sum_ns, v, Memory_Order::relaxed);
+		_update_min(v);
+		_update_max(v);
+	}
+
+	// Add samples of `src` into this histogram, safe against concurrent record_atomic()
+	void merge(Latency_Histogram& src){
+		using atomic::Memory_Order;
+		for(isize i = 0; i < bucket_count; i++){
+			u64 n = atomic::load(&src.counts[i], Memory_Order::relaxed);
+			if(n != 0){
+				atomic::fetch_add(&counts[i], n, Memory_Order::relaxed);
+			}
+		}
+		atomic::fetch_add(&total, atomic::load(&src.total, Memory_Order::relaxed), Memory_Order::relaxed);
+		atomic::fetch_add(&sum_ns, atomic::load(&src.sum_ns, Memory_Order::relaxed), Memory_Order::relaxed);
+		_update_min(atomic::load(&src.min_ns, Memory_Order::relaxed));
+		_update_max(atomic::load(&src.max_ns, Memory_Order::relaxed));
+	}
+
+	void reset(){
+		using atomic::Memory_Order;
+		for(isize i = 0; i < bucket_count; i++){
+			atomic::store(&counts[i], u64(0), Memory_Order::relaxed);
+		}
+		atomic::store(&total, u64(0), Memory_Order::relaxed);
+		atomic::store(&sum_ns, u64(0), Memory_Order::relaxed);
+		atomic::store(&min_ns, ~u64(0), Memory_Order::relaxed);
+		atomic::store(&max_ns, u64(0), Memory_Order::relaxed);
+	}
+
+	u64 count(){
+		return atomic::load(&total, atomic::Memory_Order::relaxed);
+	}
+
+	Duration min(){
+		return count() > 0 ? nanoseconds(atomic::load(&min_ns, atomic::Memory_Order::relaxed)) : nanoseconds(0);
+	}
+
+	Duration max(){
+		return nanoseconds(atomic::load(&max_ns, atomic::Memory_Order::relaxed));
+	}
+
+	Duration mean(){
+		u64 n = count();
+		return n > 0 ? nanoseconds(atomic::load(&sum_ns, atomic::Memory_Order::relaxed) / n) : nanoseconds(0);
+	}
+
+	// Value at percentile `p` (0 to 100), e.g. percentile(99.9) for p999
+	Duration percentile(f64 p){
+		u64 n = count();
+		if(n == 0){ return nanoseconds(0); }
+
+		f64 rank = (clamp(0.0, p, 100.0) / 100.0) * f64(n);
+		u64 target = ::max(u64(1), u64(rank + 0.999999));
+		u64 seen = 0;
+		for(isize i = 0; i < bucket_count; i++){
+			seen += atomic::load(&counts[i], atomic::Memory_Order::relaxed);
+			if(seen >= target){
+				u64 v = ::min(bucket_upper_bound(i), atomic::load(&max_ns, atomic::Memory_Order::relaxed));
+				return nanoseconds(i64(v));
+			}
+		}
+		return max();
+	}
+
+	void _update_min(u64 v){
+		u64 cur = atomic::load(&min_ns, atomic::Memory_Order::relaxed);
+		while(v < cur && !atomic::compare_exchange_weak(&min_ns, &cur, v, atomic::Memory_Order::relaxed));
+	}
+
+	void _update_max(u64 v){
+		u64 cur = atomic::load(&max_ns, atomic::Memory_Order::relaxed);
+		while(v > cur && !atomic::compare_exchange_weak(&max_ns, &cur, v, atomic::Memory_Order::relaxed));
+	}
+};
+}
+
+/* ---------------- Intrusive List ---------------- */
+// Doubly linked list threaded through a List_Node embedded in the elements,
+// the list never allocates. Get back to the element with containerof().
+struct List_Node {
+	List_Node* prev = nullptr;
+	List_Node* next = nullptr;
+};
+
+struct Intrusive_List {
+	List_Node* first = nullptr;
+	List_Node* last = nullptr;
+	isize length = 0;
+
+	auto len() const { return length; }
+
+	bool empty() const { return length == 0; }
+
+	void push_front(List_Node* node){
+		node->prev = nullptr;
+		node->next = first;
+		if(first){ first->prev = node; } else { last = node; }
+		first = node;
+		length += 1;
+	}
+
+	void push_back(List_Node* node){
+		node->next = nullptr;
+		node->prev = last;
+		if(last){ last->next = node; } else { first = node; }
+		last = node;
+		length += 1;
+	}
+
+	// Unlink `node`, which must be in this list
+	void remove(List_Node* node){
+		if(node->prev){ node->prev->next = node->next; } else { first = node->next; }
+		if(node->next){ node->next->prev = node->prev; } else { last = node->prev; }
+		node->prev = nullptr;
+		node->next = nullptr;
+		length -= 1;
+	}
+
+	List_Node* pop_front(){
+		List_Node* node = first;
+		if(node){ remove(node); }
+		return node;
+	}
+
+	List_Node* pop_back(){
+		List_Node* node = last;
+		if(node){ remove(node); }
+		return node;
+	}
+
+	void move_to_front(List_Node* node){
+		if(node == first){ return; }
+		remove(node);
+		push_front(node);
+	}
+
+	void clear(){
+		first = nullptr;
+		last = nullptr;
+		length = 0;
+	}
+};
+
+/* ---------------- Hash Map ---------------- */
+template<typename T>
+using Hash_Map_Func = u64 (*)(T const* data);
+
+// fnv64a, but disallows a hash value of 0
+template<typename T>
+u64 default_hash_map_func(T const* data){
+	constexpr u64 fnv_prime = 0x00000100000001b3ull;
+	constexpr u64 fnv_offset_basis = 0xcbf29ce484222325ull;
+	u64 hash = fnv_offset_basis;
+
+	auto byte_data = slice<byte>::from((byte*) data, sizeof(T));
+	for(auto b : byte_data){
+		hash = hash ^ u64(b);
+		hash = hash * fnv_prime;
+	}
+
+	return hash | (hash == 0); /* Ensure hash is never 0 */
+}
+
+// Strings hash their contents, not the (pointer, length) pair
+template<>
+inline u64 default_hash_map_func<string>(string const* data){
+	constexpr u64 fnv_prime = 0x00000100000001b3ull;
+	constexpr u64 fnv_offset_basis = 0xcbf29ce484222325ull;
+	u64 hash = fnv_offset_basis;
+
+	byte const* bytes = data->raw_data();
+	for(isize i = 0; i < data->len(); i++){
+		hash = hash ^ u64(bytes[i]);
+		hash = hash * fnv_prime;
+	}
+
+	return hash | (hash == 0); /* Ensure hash is never 0 */
+}
+
+// Open addressing with linear probing. The hash is stored next to each entry,
+// 0 marks an empty slot (hash functions must never return 0). Removal shifts
+// the following entries back instead of leaving tombstones. Keys and values are
+// moved around with memcpy. A `string` key is stored as the view itself, its
+// bytes are not copied and must outlive the entry.
+template<typename K, typename V>
+struct Hash_Map {
+	static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>, "Hash_Map keys and values must be trivially copyable");
+
+	struct Entry {
+		u64 hash;
+		K key;
+		V value;
+	};
+
+	Entry* entries = nullptr;
+	isize capacity = 0; /* Always 0 or a power of 2 */
+	isize length = 0;
+	mem::Allocator allocator;
+	Hash_Map_Func<K> hash_func = default_hash_map_func<K>;
+
+	auto len() const { return length; }
+
+	auto cap() const { return capacity; }
+
+	Option<V&> get(K const& key){
+		isize i = _find(key);
+		if(i < 0){ return {}; }
+		return entries[i].value;
+	}
+
+	bool contains(K const& key){
+		return _find(key) >= 0;
+	}
+
+	// Insert or overwrite
+	mem::Allocator_Error set(K const& key, V const& value){
+		if((length + 1) * 4 > capacity * 3){
+			auto err = resize(max(isize(16), capacity * 2));
+			if(err != mem::Allocator_Error::none){ return err; }
+		}
+		u64 hash = hash_func(&key);
+		isize mask = capacity - 1;
+		for(isize i = isize(hash) & mask;; i = (i + 1) & mask){
+			Entry& e = entries[i];
+			if(e.hash == 0){
+				e.hash = hash;
+				e.key = key;
+				e.value = value;
+				length += 1;
+				return mem::Allocator_Error::none;
+			}
+			if(e.hash == hash && _key_eq(e.key, key)){
+				e.value = value;
+				return mem::Allocator_Error::none;
+			}
+		}
+	}
+
+	Option<V> remove(K const& key){
+		isize i = _find(key);
+		if(i < 0){ return {}; }
+		V removed = entries[i].value;
+
+		/* Shift back entries that probed past the hole */
+		isize mask = capacity - 1;
+		isize hole = i;
+		for(isize j = (i + 1) & mask; entries[j].hash != 0; j = (j + 1) & mask){
+			isize ideal = isize(entries[j].hash) & mask;
+			bool can_move = hole <= j ? (ideal <= hole || ideal > j) : (ideal <= hole && ideal > j);
+			if(can_move){
+				entries[hole] = entries[j];
+				hole = j;
+			}
+		}
+		entries[hole].hash = 0;
+		length -= 1;
+		return removed;
+	}
+
+	// Rehash into `new_cap` slots (rounded up to a power of 2)
+	mem::Allocator_Error resize(isize new_cap){
+		new_cap = isize(std::bit_ceil(usize(max(new_cap, isize(1)))));
+		if(length * 4 > new_cap * 3){ return mem::Allocator_Error::none; }
+
+		auto new_entries = (Entry*)allocator.alloc(new_cap * sizeof(Entry), alignof(Entry));
+		if(new_entries == nullptr){
+			return mem::last_error();
+		}
+
+		isize mask = new_cap - 1;
+		for(isize i = 0; i < capacity; i++){
+			if(entries[i].hash == 0){ continue; }
+			isize j = isize(entries[i].hash) & mask;
+			while(new_entries[j].hash != 0){
+				j = (j + 1) & mask;
+			}
+			new_entries[j] = entries[i];
+		}
+		allocator.free(entries, capacity * sizeof(Entry));
+		entries = new_entries;
+		capacity = new_cap;
+		return mem::Allocator_Error::none;
+	}
+
+	// Call f(key, value) for every entry, in no particular order
+	template<typename F>
+	void for_each(F f){
+		for(isize i = 0; i < capacity; i++){
+			if(entries[i].hash != 0){
+				f(entries[i].key, entries[i].value);
+			}
+		}
+	}
+
+	void clear(){
+		if(entries){ mem::set(entries, 0, capacity * sizeof(Entry)); }
+		length = 0;
+	}
+
+	static Hash_Map from(mem::Allocator allocator, isize initial_cap = 16, Hash_Map_Func<K> hash_func = default_hash_map_func<K>){
+		Hash_Map m;
+		m.allocator = allocator;
+		m.hash_func = hash_func;
+		if(initial_cap > 0){
+			m.resize(initial_cap);
+		}
+		return m;
+	}
+
+	void destroy(){
+		allocator.free(entries, capacity * sizeof(Entry));
+		entries = nullptr;
+		capacity = 0;
+		length = 0;
+	}
+
+	static bool _key_eq(K const& a, K const& b){
+		if constexpr(std::is_same_v<K, string>){
+			return a == b;
+		} else if constexpr(std::is_arithmetic_v<K> || std::is_pointer_v<K> || std::is_enum_v<K>){
+			return a == b;
+		} else {
+			return mem::compare(&a, &b, sizeof(K)) == 0;
+		}
+	}
+
+	isize _find(K const& key){
+		if(length == 0){ return -1; }
+		u64 hash = hash_func(&key);
+		isize mask = capacity - 1;
+		for(isize i = isize(hash) & mask;; i = (i + 1) & mask){
+			Entry& e = entries[i];
+			if(e.hash == 0){ return -1; }
+			if(e.hash == hash && _key_eq(e.key, key)){ return i; }
+		}
+	}
+};
+
+/* ---------------- LRU Cache ---------------- */
+// Fixed capacity cache evicting the least recently used entry. Entries come
+// from a mem::Pool and are linked into a recency list, the hash map indexes
+// them by key. Everything is sized up front, so get/put/evict never touch the
+// backing allocator. For that reason `string` keys are not copied either: the
+// caller keeps their bytes alive until the entry is evicted or removed.
+template<typename K, typename V>
+struct LRU_Cache {
+	struct Entry {
+		List_Node node;
+		K key;
+		V value;
+	};
+
+	Hash_Map<K, Entry*> index;
+	Intrusive_List order; /* Most recently used first */
+	mem::Pool pool;
+	isize capacity = 0;
+
+	auto len() const { return order.len(); }
+
+	// Value for `key`, marking it as most recently used
+	Option<V&> get(K const& key){
+		auto found = index.get(key);
+		if(!found.ok()){ return {}; }
+		Entry* e = found.unwrap_unchecked();
+		order.move_to_front(&e->node);
+		return e->value;
+	}
+
+	// Value without updating recency
+	Option<V&> peek(K const& key){
+		auto found = index.get(key);
+		if(!found.ok()){ return {}; }
+		return found.unwrap_unchecked()->value;
+	}
+
+	// Insert or overwrite, evicting the least recently used entry when full
+	void put(K const& key, V value){
+		auto found = index.get(key);
+		if(found.ok()){
+			Entry* e = found.unwrap_unchecked();
+			e->value = static_cast<V&&>(value);
+			order.move_to_front(&e->node);
+			return;
+		}
+		if(capacity == 0){ return; }
+		if(order.len() >= capacity){
+			evict();
+		}
+
+		/* Pool and map were sized for `capacity` entries, neither can fail here */
+		auto e = (Entry*)pool.alloc();
+		new (e) Entry{List_Node{}, key, static_cast<V&&>(value)};
+		order.push_front(&e->node);
+		(void)index.set(key, e);
+	}
+
+	bool remove(K const& key){
+		auto found = index.remove(key);
+		if(!found.ok()){ return false; }
+		_release(found.unwrap_unchecked());
+		return true;
+	}
+
+	// Drop the least recently used entry, returns false if empty
+	bool evict(){
+		List_Node* node = order.last;
+		if(!node){ return false; }
+		Entry* e = containerof(node, Entry, node);
+		(void)index.remove(e->key);
+		_release(e);
+		return true;
+	}
+
+	void clear(){
+		while(evict()){}
+	}
+
+	static LRU_Cache from(mem::Allocator allocator, isize capacity){
+		LRU_Cache c;
+		c.capacity = max(capacity, isize(0));
+		c.index = Hash_Map<K, Entry*>::from(allocator, (c.capacity * 4) / 3 + 1);
+		c.pool = mem::Pool::from(allocator, sizeof(Entry), alignof(Entry), max(c.capacity, isize(1)));
+		c.pool.reserve(c.capacity);
+		return c;
+	}
+
+	void destroy(){
+		clear();
+		index.destroy();
+		pool.destroy();
+	}
+
+	void _release(Entry* e){
+		order.remove(&e->node);
+		e->~Entry();
+		pool.free(e);
+	}
+};
+
+/* ---------------- B-Tree Map ---------------- */
+// Ordered map as a B+tree: values live in leaves linked in key order, inner
+// nodes only hold separators. Wide nodes keep the tree shallow and scan keys
+// inside a node linearly, which for arithmetic keys compiles to branchless
+// vector compares. Every node takes `node_size` bytes so a mem::Pool with that
+// block size can back the map. Keys need operator<, keys and values are moved
+// with memcpy.
+template<typename K, typename V, int Fanout = 32>
+struct BTree_Map {
+	static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>, "BTree_Map keys and values must be trivially copyable");
+	static_assert(Fanout >= 4, "BTree_Map fanout must be at least 4");
+
+	static constexpr i32 min_leaf = Fanout / 2;
+	static constexpr i32 min_inner_keys = (Fanout + 1) / 2 - 1;
+	static constexpr isize max_height = 64;
+
+	struct Node {
+		i32 count; /* Keys held */
+		bool is_leaf;
+	};
+
+	struct Leaf : Node {
+		Leaf* prev;
+		Leaf* next;
+		K keys[Fanout];
+		V values[Fanout];
+	};
+
+	// children[i] holds keys in [keys[i-1], keys[i])
+	struct Inner : Node {
+		K keys[Fanout - 1];
+		Node* children[Fanout];
+	};
+
+	static constexpr isize node_size = max(sizeof(Leaf), sizeof(Inner));
+	static constexpr isize node_align = max(alignof(Leaf), alignof(Inner));
+
+	// Keys and values of one leaf that fall in a range
+	struct Leaf_View {
+		slice<K> keys;
+		slice<V> values;
+	};
+
+	// Walks [lo, hi) one leaf at a time
+	struct Range {
+		Leaf* leaf = nullptr;
+		isize start = 0;
+		K hi;
+		bool bounded = false;
+
+		Option<Leaf_View> next(){
+			while(leaf != nullptr){
+				Leaf* cur = leaf;
+				isize begin = start;
+				isize end = bounded ? _rank_lower(cur->keys, cur->count, hi) : cur->count;
+				leaf = (end == cur->count) ? cur->next : nullptr;
+				start = 0;
+				if(end > begin){
+					return Leaf_View{
+						slice<K>::from(&cur->keys[begin], end - begin),
+						slice<V>::from(&cur->values[begin], end - begin),
+					};
+				}
+			}
+			return {};
+		}
+	};
+
+	Node* root = nullptr;
+	Leaf* first_leaf = nullptr;
+	isize length = 0;
+	isize height = 0; /* Levels of inner nodes above the leaves */
+	mem::Allocator allocator;
+
+	auto len() const { return length; }
+
+	Option<V&> get(K const& key){
+		if(root == nullptr){ return {}; }
+		Leaf* leaf = _find_leaf(key);
+		isize i = _rank_lower(leaf->keys, leaf->count, key);
+		if(i < leaf->count && !(key < leaf->keys[i])){
+			return leaf->values[i];
+		}
+		return {};
+	}
+
+	bool contains(K const& key){
+		return get(key).ok();
+	}
+
+	// Insert or overwrite. Nodes needed for splits are allocated up front, so
+	// on failure the map is unchanged.
+	mem::Allocator_Error set(K const& key, V const& value){
+		if(root == nullptr){
+			Leaf* leaf = (Leaf*)_alloc_node(true);
+			if(leaf == nullptr){ return mem::last_error(); }
+			root = leaf;
+			first_leaf = leaf;
+		}
+
+		/* A split propagates up through every full node on the path */
+		Node* spare[max_height + 1];
+		isize needed = _splits_needed(key);
+		for(isize i = 0; i < needed; i++){
+			spare[i] = _alloc_node(false);
+			if(spare[i] == nullptr){
+				for(isize j = 0; j < i; j++){ allocator.free(spare[j], node_size); }
+				return mem::last_error();
+			}
+		}
+
+		isize used = 0;
+		Split s = _insert(root, key, value, spare, &used);
+		if(s.right != nullptr){
+			auto new_root = (Inner*)spare[used++];
+			new_root->is_leaf = false;
+			new_root->count = 1;
+			new_root->keys[0] = s.separator;
+			new_root->children[0] = root;
+			new_root->children[1] = s.right;
+			root = new_root;
+			height += 1;
+		}
+		for(isize i = used; i < needed; i++){ allocator.free(spare[i], node_size); }
+		return mem::Allocator_Error::none;
+	}
+
+	Option<V> remove(K const& key){
+		if(root == nullptr){ return {}; }
+		Option<V> removed;
+		_remove(root, key, &removed);
+		if(!root->is_leaf && root->count == 0){
+			Node* old = root;
+			root = ((Inner*)root)->children[0];
+			allocator.free(old, node_size);
+			height -= 1;
+		}
+		return removed;
+	}
+
+	// Entries with lo <= key < hi
+	Range range(K const& lo, K const& hi){
+		Range r;
+		r.hi = hi;
+		r.bounded = true;
+		if(root == nullptr){ return r; }
+		r.leaf = _find_leaf(lo);
+		r.start = _rank_lower(r.leaf->keys, r.leaf->count, lo);
+		return r;
+	}
+
+	// Entries with lo <= key
+	Range range_from(K const& lo){
+		Range r;
+		if(root == nullptr){ return r; }
+		r.leaf = _find_leaf(lo);
+		r.start = _rank_lower(r.leaf->keys, r.leaf->count, lo);
+		return r;
+	}
+
+	Range all(){
+		Range r;
+		r.leaf = first_leaf;
+		return r;
+	}
+
+	// Build from strictly increasing keys in O(n), leaves and inner nodes are
+	// filled evenly to near capacity. Returns an empty map if allocation fails.
+	static BTree_Map from_sorted(mem::Allocator allocator, slice<K> keys, slice<V> values){
+		bounds_check(keys.len() == values.len(), "Key and value counts differ");
+		BTree_Map m;
+		m.allocator = allocator;
+		isize n = keys.len();
+		if(n == 0){ return m; }
+		for(isize i = 1; i < n; i++){
+			assert(keys[i - 1] < keys[i], "Keys must be sorted and unique");
+		}
+
+		/* Allocate every node first so failure can't leave a partial tree */
+		isize leaves = (n + Fanout - 1) / Fanout;
+		isize total = leaves;
+		for(isize c = leaves; c > 1; ){
+			c = (c + Fanout - 1) / Fanout;
+			total += c;
+		}
+		auto nodes = (Node**)allocator.alloc(total * sizeof(Node*), alignof(Node*));
+		auto level_min = (K*)allocator.alloc(leaves * sizeof(K), alignof(K));
+		isize allocated = 0;
+		if(nodes && level_min){
+			for(; allocated < total; allocated++){
+				nodes[allocated] = m._alloc_node(false);
+				if(nodes[allocated] == nullptr){ break; }
+			}
+		}
+		if(allocated < total){
+			for(isize i = 0; i < allocated; i++){ allocator.free(nodes[i], node_size); }
+			allocator.free(nodes, total * sizeof(Node*));
+			allocator.free(level_min, leaves * sizeof(K));
+			return m;
+		}
+
+		/* Leaves: n entries split evenly, so each holds at least Fanout / 2 */
+		Leaf* prev = nullptr;
+		for(isize l = 0; l < leaves; l++){
+			isize lo = n * l / leaves, hi = n * (l + 1) / leaves;
+			auto leaf = (Leaf*)nodes[l];
+			leaf->is_leaf = true;
+			leaf->count = i32(hi - lo);
+			mem::copy_no_overlap(leaf->keys, &keys.raw_data()[lo], (hi - lo) * sizeof(K));
+			mem::copy_no_overlap(leaf->values, &values.raw_data()[lo], (hi - lo) * sizeof(V));
+			leaf->prev = prev;
+			if(prev){ prev->next = leaf; } else { m.first_leaf = leaf; }
+			prev = leaf;
+			level_min[l] = keys[lo];
+		}
+
+		/* Inner levels bottom up, each level's nodes follow the previous in `nodes` */
+		isize level_start = 0;
+		isize count = leaves;
+		while(count > 1){
+			isize parents = (count + Fanout - 1) / Fanout;
+			isize parent_start = level_start + count;
+			for(isize p = 0; p < parents; p++){
+				isize lo = count * p / parents, hi = count * (p + 1) / parents;
+				auto inner = (Inner*)nodes[parent_start + p];
+				inner->count = i32(hi - lo - 1);
+				for(isize c = lo; c < hi; c++){
+					inner->children[c - lo] = nodes[level_start + c];
+					if(c > lo){ inner->keys[c - lo - 1] = level_min[c]; }
+				}
+				level_min[p] = level_min[lo];
+			}
+			level_start = parent_start;
+			count = parents;
+			m.height += 1;
+		}
+		m.root = nodes[level_start];
+		m.length = n;
+
+		allocator.free(nodes, total * sizeof(Node*));
+		allocator.free(level_min, leaves * sizeof(K));
+		return m;
+	}
+
+	static BTree_Map from(mem::Allocator allocator){
+		BTree_Map m;
+		m.allocator = allocator;
+		return m;
+	}
+
+	void destroy(){
+		if(root){ _destroy_node(root); }
+		root = nullptr;
+		first_leaf = nullptr;
+		length = 0;
+		height = 0;
+	}
+
+	/* Internals */
+	struct Split {
+		K separator;
+		Node* right;
+	};
+
+	// Keys in keys[0..n) that are less than `key`
+	static isize _rank_lower(K const* keys, isize n, K const& key){
+		if constexpr(std::is_arithmetic_v<K>){
+			isize r = 0;
+			for(isize i = 0; i < n; i++){ r += keys[i] < key; }
+			return r;
+		} else {
+			return lower_bound(slice<K>::from((K*)keys, n), key);
+		}
+	}
+
+	// Keys in keys[0..n) that are not greater than `key`
+	static isize _rank_upper(K const* keys, isize n, K const& key){
+		if constexpr(std::is_arithmetic_v<K>){
+			isize r = 0;
+			for(isize i = 0; i < n; i++){ r += !(key < keys[i]); }
+			return r;
+		} else {
+			return upper_bound(slice<K>::from((K*)keys, n), key);
+		}
+	}
+
+	Node* _alloc_node(bool leaf){
+		auto n = (Node*)allocator.alloc(node_size, node_align);
+		if(n){ n->is_leaf = leaf; }
+		return n;
+	}
+
+	void _destroy_node(Node* n){
+		if(!n->is_leaf){
+			auto inner = (Inner*)n;
+			for(isize i = 0; i <= inner->count; i++){
+				_destroy_node(inner->children[i]);
+			}
+		}
+		allocator.free(n, node_size);
+	}
+
+	Leaf* _find_leaf(K const& key){
+		Node* n = root;
+		while(!n->is_leaf){
+			auto inner = (Inner*)n;
+			n = inner->children[_rank_upper(inner->keys, inner->count, key)];
+		}
+		return (Leaf*)n;
+	}
+
+	// Nodes to allocate for inserting `key`: one per full node at the bottom of the path, plus a new root
+	isize _splits_needed(K const& key){
+		bool full[max_height + 1];
+		isize depth = 0;
+		Node* n = root;
+		while(!n->is_leaf){
+			auto inner = (Inner*)n;
+			full[depth++] = inner->count == Fanout - 1;
+			n = inner->children[_rank_upper(inner->keys, inner->count, key)];
+		}
+		auto leaf = (Leaf*)n;
+		if(leaf->count < Fanout){ return 0; }
+		isize i = _rank_lower(leaf->keys, leaf->count, key);
+		if(i < leaf->count && !(key < leaf->keys[i])){ return 0; }
+
+		isize needed = 1;
+		while(depth > 0 && full[depth - 1]){
+			needed += 1;
+			depth -= 1;
+		}
+		return depth == 0 ? needed + 1 : needed;
+	}
+
+	Split _insert(Node* n, K const& key, V const& value, Node** spare, isize* used){
+		if(n->is_leaf){
+			auto leaf = (Leaf*)n;
+			isize i = _rank_lower(leaf->keys, leaf->count, key);
+			if(i < leaf->count && !(key < leaf->keys[i])){
+				leaf->values[i] = value;
+				return {key, nullptr};
+			}
+			length += 1;
+			if(leaf->count < Fanout){
+				_leaf_insert_at(leaf, i, key, value);
+				return {key, nullptr};
+			}
+
+			auto right = (Leaf*)spare[(*used)++];
+			right->is_leaf = true;
+			i32 keep = (Fanout + 1) / 2;
+			right->count = leaf->count - keep;
+			mem::copy_no_overlap(right->keys, &leaf->keys[keep], right->count * sizeof(K));
+			mem::copy_no_overlap(right->values, &leaf->values[keep], right->count * sizeof(V));
+			leaf->count = keep;
+			right->next = leaf->next;
+			right->prev = leaf;
+			if(leaf->next){ leaf->next->prev = right; }
+			leaf->next = right;
+
+			if(i <= keep){
+				_leaf_insert_at(leaf, i, key, value);
+			} else {
+				_leaf_insert_at(right, i - keep, key, value);
+			}
+			return {right->keys[0], right};
+		}
+
+		auto inner = (Inner*)n;
+		isize ci = _rank_upper(inner->keys, inner->count, key);
+		Split s = _insert(inner->children[ci], key, value, spare, used);
+		if(s.right == nullptr){ return s; }
+
+		if(inner->count < Fanout - 1){
+			_inner_insert_at(inner, ci, s.separator, s.right);
+			return {key, nullptr};
+		}
+
+		/* Full: lay out all Fanout keys / Fanout + 1 children, then split */
+		K keys[Fanout];
+		Node* children[Fanout + 1];
+		mem::copy_no_overlap(keys, inner->keys, ci * sizeof(K));
+		keys[ci] = s.separator;
+		mem::copy_no_overlap(&keys[ci + 1], &inner->keys[ci], (Fanout - 1 - ci) * sizeof(K));
+		mem::copy_no_overlap(children, inner->children, (ci + 1) * sizeof(Node*));
+		children[ci + 1] = s.right;
+		mem::copy_no_overlap(&children[ci + 2], &inner->children[ci + 1], (Fanout - 1 - ci) * sizeof(Node*));
+
+		auto right = (Inner*)spare[(*used)++];
+		right->is_leaf = false;
+		i32 mid = Fanout / 2;
+		inner->count = mid;
+		mem::copy_no_overlap(inner->keys, keys, mid * sizeof(K));
+		mem::copy_no_overlap(inner->children, children, (mid + 1) * sizeof(Node*));
+		right->count = Fanout - mid - 1;
+		mem::copy_no_overlap(right->keys, &keys[mid + 1], right->count * sizeof(K));
+		mem::copy_no_overlap(right->children, &children[mid + 1], (right->count + 1) * sizeof(Node*));
+		return {keys[mid], right};
+	}
+
+	static void _leaf_insert_at(Leaf* leaf, isize i, K const& key, V const& value){
+		mem::copy(&leaf->keys[i + 1], &leaf->keys[i], (leaf->count - i) * sizeof(K));
+		mem::copy(&leaf->values[i + 1], &leaf->values[i], (leaf->count - i) * sizeof(V));
+		leaf->keys[i] = key;
+		leaf->values[i] = value;
+		leaf->count += 1;
+	}
+
+	// Insert separator at key index `i`, with `right` as the child after it
+	static void _inner_insert_at(Inner* inner, isize i, K const& separator, Node* right){
+		mem::copy(&inner->keys[i + 1], &inner->keys[i], (inner->count - i) * sizeof(K));
+		mem::copy(&inner->children[i + 2], &inner->children[i + 1], (inner->count - i) * sizeof(Node*));
+		inner->keys[i] = separator;
+		inner->children[i + 1] = right;
+		inner->count += 1;
+	}
+
+	static void _inner_erase_at(Inner* inner, isize i){
+		mem::copy(&inner->keys[i], &inner->keys[i + 1], (inner->count - i - 1) * sizeof(K));
+		mem::copy(&inner->children[i + 1], &inner->children[i + 2], (inner->count - i - 1) * sizeof(Node*));
+		inner->count -= 1;
+	}
+
+	// Returns true if `n` was left with too few keys
+	bool _remove(Node* n, K const& key, Option<V>* removed){
+		if(n->is_leaf){
+			auto leaf = (Leaf*)n;
+			isize i = _rank_lower(leaf->keys, leaf->count, key);
+			if(i >= leaf->count || key < leaf->keys[i]){ return false; }
+			*removed = leaf->values[i];
+			mem::copy(&leaf->keys[i], &leaf->keys[i + 1], (leaf->count - i - 1) * sizeof(K));
+			mem::copy(&leaf->values[i], &leaf->values[i + 1], (leaf->count - i - 1) * sizeof(V));
+			leaf->count -= 1;
+			length -= 1;
+			return leaf->count < min_leaf;
+		}
+
+		auto inner = (Inner*)n;
+		isize ci = _rank_upper(inner->keys, inner->count, key);
+		if(_remove(inner->children[ci], key, removed)){
+			_rebalance(inner, ci);
+		}
+		return inner->count < min_inner_keys;
+	}
+
+	// Fix an underfull child by borrowing from or merging with a sibling
+	void _rebalance(Inner* parent, isize ci){
+		bool has_left = ci > 0;
+		isize li = has_left ? ci - 1 : ci;  /* Left of the pair */
+		Node* left = parent->children[li];
+		Node* right = parent->children[li + 1];
+
+		if(left->is_leaf){
+			auto l = (Leaf*)left;
+			auto r = (Leaf*)right;
+			if(has_left && l->count > min_leaf){
+				_leaf_insert_at(r, 0, l->keys[l->count - 1], l->values[l->count - 1]);
+				l->count -= 1;
+				parent->keys[li] = r->keys[0];
+			}
+			else if(!has_left && r->count > min_leaf){
+				l->keys[l->count] = r->keys[0];
+				l->values[l->count] = r->values[0];
+				l->count += 1;
+				mem::copy(&r->keys[0], &r->keys[1], (r->count - 1) * sizeof(K));
+				mem::copy(&r->values[0], &r->values[1], (r->count - 1) * sizeof(V));
+				r->count -= 1;
+				parent->keys[li] = r->keys[0];
+			}
+			else {
+				mem::copy_no_overlap(&l->keys[l->count], r->keys, r->count * sizeof(K));
+				mem::copy_no_overlap(&l->values[l->count], r->values, r->count * sizeof(V));
+				l->count += r->count;
+				l->next = r->next;
+				if(r->next){ r->next->prev = l; }
+				_inner_erase_at(parent, li);
+				allocator.free(r, node_size);
+			}
+			return;
+		}
+
+		auto l = (Inner*)left;
+		auto r = (Inner*)right;
+		if(has_left && l->count > min_inner_keys){
+			/* Rotate right through the parent */
+			mem::copy(&r->keys[1], &r->keys[0], r->count * sizeof(K));
+			mem::copy(&r->children[1], &r->children[0], (r->count + 1) * sizeof(Node*));
+			r->keys[0] = parent->keys[li];
+			r->children[0] = l->children[l->count];
+			r->count += 1;
+			parent->keys[li] = l->keys[l->count - 1];
+			l->count -= 1;
+		}
+		else if(!has_left && r->count > min_inner_keys){
+			/* Rotate left through the parent */
+			l->keys[l->count] = parent->keys[li];
+			l->children[l->count + 1] = r->children[0];
+			l->count += 1;
+			parent->keys[li] = r->keys[0];
+			mem::copy(&r->keys[0], &r->keys[1], (r->count - 1) * sizeof(K));
+			mem::copy(&r->children[0], &r->children[1], r->count * sizeof(Node*));
+			r->count -= 1;
+		}
+		else {
+			l->keys[l->count] = parent->keys[li];
+			mem::copy_no_overlap(&l->keys[l->count + 1], r->keys, r->count * sizeof(K));
+			mem::copy_no_overlap(&l->children[l->count + 1], r->children, (r->count + 1) * sizeof(Node*));
+			l->count += r->count + 1;
+			_inner_erase_at(parent, li);
+			allocator.free(r, node_size);
+		}
+	}
+};
+
+/* ---------------- Radix Tree ---------------- */
+// Adaptive radix tree over string keys. Inner nodes pick the smallest of four
+// layouts that fits their children (4, 16, 48 or 256 slots) and compress
+// single-child paths into a prefix. Node16 finds a byte with one vector
+// compare. Leaves hold the whole key, which is compared once at the end.
+// Nodes and leaves come from an Arena, outgrown nodes stay in it until the
+// arena is reset. Keys are stored as views unless `copy_keys` is set, in which
+// case their bytes are copied into the arena.
+template<typename V>
+struct Radix_Tree {
+	struct Entry {
+		string key;
+		V value;
+	};
+
+	enum struct Kind : u8 { node4, node16, node48, node256 };
+
+	/* Children are tagged pointers, the low bit marks an Entry */
+	using Child = void*;
+
+	struct Node {
+		Kind kind;
+		u16 count;
+		string prefix;   /* Bytes consumed by this node before branching */
+		Entry* terminal; /* Key that ends exactly at this node */
+	};
+
+	struct Node4 : Node {
+		u8 keys[4];
+		Child children[4];
+	};
+
+	struct Node16 : Node {
+		vec<u8, 16> keys;
+		Child children[16];
+	};
+
+	struct Node48 : Node {
+		u8 index[256]; /* Slot + 1 for each byte, 0 if absent */
+		Child children[48];
+	};
+
+	struct Node256 : Node {
+		Child children[256];
+	};
+
+	Child root = nullptr;
+	isize length = 0;
+	mem::Arena* arena = nullptr;
+	bool copy_keys = false;
+
+	auto len() const { return length; }
+
+	Option<V&> get(string key){
+		Child c = root;
+		isize depth = 0;
+		while(c != nullptr){
+			if(_is_entry(c)){
+				Entry* e = _entry(c);
+				if(e->key == key){ return e->value; }
+				return {};
+			}
+			auto n = (Node*)c;
+			if(!_prefix_matches(n, key, depth)){ return {}; }
+			depth += n->prefix.len();
+			if(depth == key.len()){
+				if(n->terminal){ return n->terminal->value; }
+				return {};
+			}
+			Child* slot = _find_child(n, key.raw_data()[depth]);
+			c = slot ? *slot : nullptr;
+			depth += 1;
+		}
+		return {};
+	}
+
+	bool contains(string key){
+		return get(key).ok();
+	}
+
+	// Insert or overwrite, fails only if the arena runs out
+	mem::Allocator_Error set(string key, V const& value){
+		Child* ref = &root;
+		isize depth = 0;
+		for(;;){
+			Child c = *ref;
+			if(c == nullptr){
+				Entry* e = _make_entry(key, value);
+				if(!e){ return mem::Allocator_Error::out_of_memory; }
+				*ref = _tag(e);
+				return mem::Allocator_Error::none;
+			}
+
+			if(_is_entry(c)){
+				Entry* old = _entry(c);
+				if(old->key == key){
+					old->value = value;
+					return mem::Allocator_Error::none;
+				}
+				/* Replace the leaf with a node branching where the keys differ */
+				isize common = _common_prefix(old->key, key, depth);
+				auto n = (Node4*)_alloc_node(Kind::node4);
+				Entry* e = n ? _make_entry(key, value) : nullptr;
+				if(!e){ return mem::Allocator_Error::out_of_memory; }
+				n->prefix = _sub(old->key, depth, common);
+				isize split = depth + common;
+				_attach(n, old, split);
+				_attach(n, e, split);
+				*ref = n;
+				return mem::Allocator_Error::none;
+			}
+
+			auto n = (Node*)c;
+			isize matched = _prefix_mismatch(n, key, depth);
+			if(matched < n->prefix.len()){
+				/* Key leaves the compressed path: split the prefix */
+				auto parent = (Node4*)_alloc_node(Kind::node4);
+				Entry* e = parent ? _make_entry(key, value) : nullptr;
+				if(!e){ return mem::Allocator_Error::out_of_memory; }
+				parent->prefix = _sub(n->prefix, 0, matched);
+				u8 branch = n->prefix.raw_data()[matched];
+				n->prefix = _sub(n->prefix, matched + 1, n->prefix.len() - matched - 1);
+				_add_child4(parent, branch, n);
+				_attach(parent, e, depth + matched);
+				*ref = parent;
+				return mem::Allocator_Error::none;
+			}
+
+			depth += n->prefix.len();
+			if(depth == key.len()){
+				if(n->terminal){
+					n->terminal->value = value;
+				} else {
+					Entry* e = _make_entry(key, value);
+					if(!e){ return mem::Allocator_Error::out_of_memory; }
+					n->terminal = e;
+				}
+				return mem::Allocator_Error::none;
+			}
+
+			u8 b = key.raw_data()[depth];
+			Child* slot = _find_child(n, b);
+			if(slot){
+				ref = slot;
+				depth += 1;
+				continue;
+			}
+
+			Entry* e = _make_entry(key, value);
+			if(!e){ return mem::Allocator_Error::out_of_memory; }
+			if(!_add_child(ref, b, _tag(e))){
+				length -= 1;
+				return mem::Allocator_Error::out_of_memory;
+			}
+			return mem::Allocator_Error::none;
+		}
+	}
+
+	// Entry with the longest key that is a prefix of `query`
+	Option<Entry&> longest_prefix(string query){
+		Entry* best = nullptr;
+		Child c = root;
+		isize depth = 0;
+		while(c != nullptr){
+			if(_is_entry(c)){
+				Entry* e = _entry(c);
+				if(e->key.len() <= query.len() && mem::compare(e->key.raw_data(), query.raw_data(), e->key.len()) == 0){
+					best = e;
+				}
+				break;
+			}
+			auto n = (Node*)c;
+			if(!_prefix_matches(n, query, depth)){ break; }
+			depth += n->prefix.len();
+			if(n->terminal){ best = n->terminal; }
+			if(depth == query.len()){ break; }
+			Child* slot = _find_child(n, query.raw_data()[depth]);
+			c = slot ? *slot : nullptr;
+			depth += 1;
+		}
+		if(best){ return *best; }
+		return {};
+	}
+
+	// Call f(Entry&) for every key starting with `prefix`, in byte order
+	template<typename F>
+	void for_each_prefix(string prefix, F f){
+		Child c = root;
+		isize depth = 0;
+		while(c != nullptr){
+			if(_is_entry(c)){
+				Entry* e = _entry(c);
+				if(e->key.len() >= prefix.len() && mem::compare(e->key.raw_data(), prefix.raw_data(), prefix.len()) == 0){
+					f(*e);
+				}
+				return;
+			}
+			auto n = (Node*)c;
+			/* The query may run out inside this node's prefix */
+			isize rest = prefix.len() - depth;
+			isize cmp = min(rest, n->prefix.len());
+			if(mem::compare(n->prefix.raw_data(), prefix.raw_data() + depth, cmp) != 0){ return; }
+			if(rest <= n->prefix.len()){
+				_visit(c, f);
+				return;
+			}
+			depth += n->prefix.len();
+			Child* slot = _find_child(n, prefix.raw_data()[depth]);
+			c = slot ? *slot : nullptr;
+			depth += 1;
+		}
+	}
+
+	// Call f(Entry&) for every key, in byte order
+	template<typename F>
+	void for_each(F f){
+		if(root){ _visit(root, f); }
+	}
+
+	static Radix_Tree from(mem::Arena* arena, bool copy_keys = false){
+		Radix_Tree t;
+		t.arena = arena;
+		t.copy_keys = copy_keys;
+		return t;
+	}
+
+	/* Internals */
+	static bool _is_entry(Child c){ return (uintptr(c) & 1) != 0; }
+	static Entry* _entry(Child c){ return (Entry*)(uintptr(c) & ~uintptr(1)); }
+	static Child _tag(Entry* e){ return (Child)(uintptr(e) | 1); }
+
+	static string _sub(string s, isize start, isize n){
+		return string::from_bytes(s.raw_data() + start, n);
+	}
+
+	// Length of the common prefix of a and b starting at `depth`
+	static isize _common_prefix(string a, string b, isize depth){
+		isize n = min(a.len(), b.len());
+		isize i = depth;
+		while(i < n && a.raw_data()[i] == b.raw_data()[i]){ i += 1; }
+		return i - depth;
+	}
+
+	// Bytes of the node prefix matched by key[depth..]
+	static isize _prefix_mismatch(Node* n, string key, isize depth){
+		isize limit = min(n->prefix.len(), key.len() - depth);
+		isize i = 0;
+		while(i < limit && n->prefix.raw_data()[i] == key.raw_data()[depth + i]){ i += 1; }
+		return i;
+	}
+
+	static bool _prefix_matches(Node* n, string key, isize depth){
+		isize plen = n->prefix.len();
+		return key.len() - depth >= plen && mem::compare(n->prefix.raw_data(), key.raw_data() + depth, plen) == 0;
+	}
+
+	Entry* _make_entry(string key, V const& value){
+		auto e = (Entry*)arena->alloc(sizeof(Entry), alignof(Entry));
+		if(!e){ return nullptr; }
+		if(copy_keys && key.len() > 0){
+			auto bytes = (byte*)arena->alloc_non_zero(key.len(), 1);
+			if(!bytes){ return nullptr; }
+			mem::copy_no_overlap(bytes, key.raw_data(), key.len());
+			key = string::from_bytes(bytes, key.len());
+		}
+		e->key = key;
+		e->value = value;
+		length += 1;
+		return e;
+	}
+
+	Node* _alloc_node(Kind kind){
+		isize size = 0;
+		switch(kind){
+		case Kind::node4:   size = sizeof(Node4); break;
+		case Kind::node16:  size = sizeof(Node16); break;
+		case Kind::node48:  size = sizeof(Node48); break;
+		case Kind::node256: size = sizeof(Node256); break;
+		}
+		auto n = (Node*)arena->alloc(size, alignof(Node16));
+		if(n){ n->kind = kind; }
+		return n;
+	}
+
+	// Hang entry `e` below a fresh node4 whose prefix ends at key offset `split`
+	static void _attach(Node4* n, Entry* e, isize split){
+		if(e->key.len() == split){
+			n->terminal = e;
+		} else {
+			_add_child4(n, e->key.raw_data()[split], _tag(e));
+		}
+	}
+
+	static void _add_child4(Node4* n, u8 b, Child child){
+		isize i = n->count;
+		while(i > 0 && n->keys[i - 1] > b){
+			n->keys[i] = n->keys[i - 1];
+			n->children[i] = n->children[i - 1];
+			i -= 1;
+		}
+		n->keys[i] = b;
+		n->children[i] = child;
+		n->count += 1;
+	}
+
+	static Child* _find_child(Node* n, u8 b){
+		switch(n->kind){
+		case Kind::node4: {
+			auto n4 = (Node4*)n;
+			for(isize i = 0; i < n4->count; i++){
+				if(n4->keys[i] == b){ return &n4->children[i]; }
+			}
+			return nullptr;
+		}
+		case Kind::node16: {
+			auto n16 = (Node16*)n;
+			vec<u8, 16> needle;
+			for(int i = 0; i < 16; i++){ needle[i] = b; }
+			auto words = bit_cast<vec<u64, 2>>(n16->keys == needle);
+			/* Lanes past count are zero, a hit there comes after any real one */
+			isize i = words[0] != 0 ? std::countr_zero(words[0]) / 8
+			        : words[1] != 0 ? 8 + std::countr_zero(words[1]) / 8
+			        : 16;
+			return i < n16->count ? &n16->children[i] : nullptr;
+		}
+		case Kind::node48: {
+			auto n48 = (Node48*)n;
+			u8 slot = n48->index[b];
+			return slot ? &n48->children[slot - 1] : nullptr;
+		}
+		case Kind::node256: {
+			auto n256 = (Node256*)n;
+			return n256->children[b] ? &n256->children[b] : nullptr;
+		}
+		}
+		return nullptr;
+	}
+
+	// Add a child to the node at *ref, growing it into the next layout if full
+	bool _add_child(Child* ref, u8 b, Child child){
+		auto n = (Node*)*ref;
+		switch(n->kind){
+		case Kind::node4: {
+			auto n4 = (Node4*)n;
+			if(n4->count < 4){
+				_add_child4(n4, b, child);
+				return true;
+			}
+			auto n16 = (Node16*)_alloc_node(Kind::node16);
+			if(!n16){ return false; }
+			_copy_header(n16, n4);
+			for(isize i = 0; i < 4; i++){
+				n16->keys[i] = n4->keys[i];
+				n16->children[i] = n4->children[i];
+			}
+			*ref = n16;
+			return _add_child(ref, b, child);
+		}
+		case Kind::node16: {
+			auto n16 = (Node16*)n;
+			if(n16->count < 16){
+				isize i = n16->count;
+				while(i > 0 && n16->keys[i - 1] > b){
+					n16->keys[i] = n16->keys[i - 1];
+					n16->children[i] = n16->children[i - 1];
+					i -= 1;
+				}
+				n16->keys[i] = b;
+				n16->children[i] = child;
+				n16->count += 1;
+				return true;
+			}
+			auto n48 = (Node48*)_alloc_node(Kind::node48);
+			if(!n48){ return false; }
+			_copy_header(n48, n16);
+			for(isize i = 0; i < 16; i++){
+				n48->index[n16->keys[i]] = u8(i + 1);
+				n48->children[i] = n16->children[i];
+			}
+			*ref = n48;
+			return _add_child(ref, b, child);
+		}
+		case Kind::node48: {
+			auto n48 = (Node48*)n;
+			if(n48->count < 48){
+				n48->children[n48->count] = child;
+				n48->index[b] = u8(n48->count + 1);
+				n48->count += 1;
+				return true;
+			}
+			auto n256 = (Node256*)_alloc_node(Kind::node256);
+			if(!n256){ return false; }
+			_copy_header(n256, n48);
+			for(isize i = 0; i < 256; i++){
+				if(n48->index[i]){ n256->children[i] = n48->children[n48->index[i] - 1]; }
+			}
+			*ref = n256;
+			return _add_child(ref, b, child);
+		}
+		case Kind::node256: {
+			auto n256 = (Node256*)n;
+			n256->children[b] = child;
+			n256->count += 1;
+			return true;
+		}
+		}
+		return false;
+	}
+
+	static void _copy_header(Node* dst, Node const* src){
+		dst->count = src->count;
+		dst->prefix = src->prefix;
+		dst->terminal = src->terminal;
+	}
+
+	template<typename F>
+	static void _visit(Child c, F& f){
+		if(_is_entry(c)){
+			f(*_entry(c));
+			return;
+		}
+		auto n = (Node*)c;
+		if(n->terminal){ f(*n->terminal); }
+		switch(n->kind){
+		case Kind::node4: {
+			auto n4 = (Node4*)n;
+			for(isize i = 0; i < n4->count; i++){ _visit(n4->children[i], f); }
+		} break;
+		case Kind::node16: {
+			auto n16 = (Node16*)n;
+			for(isize i = 0; i < n16->count; i++){ _visit(n16->children[i], f); }
+		} break;
+		case Kind::node48: {
+			auto n48 = (Node48*)n;
+			for(isize i = 0; i < 256; i++){
+				if(n48->index[i]){ _visit(n48->children[n48->index[i] - 1], f); }
+			}
+		} break;
+		case Kind::node256: {
+			auto n256 = (Node256*)n;
+			for(isize i = 0; i < 256; i++){
+				if(n256->children[i]){ _visit(n256->children[i], f); }
+			}
+		} break;
+		}
+	}
+};
+
+/* ---------------- Epoch Reclamation ---------------- */
+// Epoch based reclamation for lock-free containers. A thread pins the global
+// epoch while it holds pointers into a shared structure, and retires the nodes
+// it unlinked instead of freeing them. Retired nodes wait in a per thread
+// limbo list tagged with the epoch they were retired in, and go back to their
+// allocator once the epoch has advanced twice since, at which point no pinned
+// thread can still reach them. The epoch only advances once every pinned
+// thread has observed the current one.
+//
+//     auto guard = ebr::pin();
+//     Node* n = ...;  /* unlink n */
+//     ebr::retire(n, allocator);
+//
+// Threads register on first use. A thread's record is released when it exits
+// and is reused by the next new thread, together with whatever is still in its
+// limbo lists. Allocators receiving retired nodes must be thread safe, only the
+// memory is released, destructors are not run.
+namespace ebr {
+constexpr inline isize limbo_count = 3;
+constexpr inline isize collect_interval = 128; /* Pins between collection attempts */
+constexpr inline isize limbo_threshold = 256;  /* Retired nodes in one list that force a collection */
+
+struct Retired {
+	void* ptr;
+	isize size;
+	mem::Allocator allocator;
+};
+
+struct Participant {
+	std::atomic<u64> state; /* Pinned epoch << 1 | 1, 0 when not pinned */
+	std::atomic<bool> in_use;
+	Participant* next;
+	isize pin_depth;
+	isize pin_count;
+	Dynamic_Array<Retired> limbo[limbo_count];
+	u64 limbo_epoch[limbo_count];
+};
+
+inline std::atomic<u64> _epoch = 0;
+inline std::atomic<Participant*> _participants = nullptr;
+inline thread_local Participant* _local = nullptr;
+
+static inline void collect();
+
+struct _Thread_Exit {
+	~_Thread_Exit(){
+		if(_local == nullptr){ return; }
+		collect();
+		atomic::store(&_local->in_use, false, atomic::Memory_Order::release);
+		_local = nullptr;
+	}
+};
+inline thread_local _Thread_Exit _thread_exit;
+
+static inline
+Participant* _register_thread(){
+	(void)&_thread_exit; /* Constructs it, so the record is released on exit */
+
+	for(Participant* p = atomic::load(&_participants, atomic::Memory_Order::acquire); p != nullptr; p = p->next){
+		bool expected = false;
+		if(!atomic::load(&p->in_use, atomic::Memory_Order::relaxed) &&
+		   atomic::compare_exchange_strong(&p->in_use, &expected, true, atomic::Memory_Order::acquire)){
+			_local = p;
+			return p;
+		}
+	}
+
+	auto heap = mem::heap_allocator();
+	auto p = heap.make<Participant>();
+	for(isize i = 0; i < limbo_count; i++){
+		p->limbo[i] = Dynamic_Array<Retired>::from(heap, 0);
+	}
+	atomic::store(&p->in_use, true, atomic::Memory_Order::relaxed);
+
+	Participant* head = atomic::load(&_participants, atomic::Memory_Order::relaxed);
+	do {
+		p->next = head;
+	} while(!atomic::compare_exchange_weak(&_participants, &head, p, atomic::Memory_Order::release));
+
+	_local = p;
+	return p;
+}
+
+static inline
+Participant* _participant(){
+	Participant* p = _local;
+	[[unlikely]] if(p == nullptr){
+		p = _register_thread();
+	}
+	return p;
+}
+
+static inline
+void _free_limbo(Participant* p, isize i){
+	for(Retired& r : p->limbo[i]){
+		r.allocator.free(r.ptr, r.size);
+	}
+	p->limbo[i].length = 0;
+}
+
+// Advance the global epoch if every pinned thread has observed it
+static inline
+bool try_advance(){
+	atomic::thread_fence(atomic::Memory_Order::seq_cst);
+	u64 epoch = atomic::load(&_epoch, atomic::Memory_Order::relaxed);
+	for(Participant* p = atomic::load(&_participants, atomic::Memory_Order::acquire); p != nullptr; p = p->next){
+		/* Pairs with unpin(), whatever that thread read is done before we free it */
+		u64 state = atomic::load(&p->state, atomic::Memory_Order::acquire);
+		if((state & 1) && (state >> 1) != epoch){
+			return false;
+		}
+	}
+	return atomic::compare_exchange_strong(&_epoch, &epoch, epoch + 1, atomic::Memory_Order::acq_rel);
+}
+
+static inline
+void _free_expired(Participant* p, u64 epoch){
+	for(isize i = 0; i < limbo_count; i++){
+		if(p->limbo[i].len() > 0 && p->limbo_epoch[i] + 2 <= epoch){
+			_free_limbo(p, i);
+		}
+	}
+}
+
+// Try to advance the epoch, then free the expired limbo lists of this thread
+// and of exited threads whose records are not in use
+static inline
+void collect(){
+	Participant* self = _participant();
+	try_advance();
+	u64 epoch = atomic::load(&_epoch, atomic::Memory_Order::acquire);
+	_free_expired(self, epoch);
+
+	for(Participant* p = atomic::load(&_participants, atomic::Memory_Order::acquire); p != nullptr; p = p->next){
+		bool expected = false;
+		if(p != self && !atomic::load(&p->in_use, atomic::Memory_Order::relaxed) &&
+		   atomic::compare_exchange_strong(&p->in_use, &expected, true, atomic::Memory_Order::acquire)){
+			_free_expired(p, epoch);
+			atomic::store(&p->in_use, false, atomic::Memory_Order::release);
+		}
+	}
+}
+
+static inline
+void unpin(){
+	Participant* p = _local;
+	assert(p != nullptr && p->pin_depth > 0, "Unpin without matching pin");
+	p->pin_depth -= 1;
+	if(p->pin_depth == 0){
+		atomic::store(&p->state, u64(0), atomic::Memory_Order::release);
+	}
+}
+
+struct [[nodiscard]] Guard {
+	Guard() = default;
+	Guard(Guard const&) = delete;
+	Guard& operator=(Guard const&) = delete;
+	~Guard(){ unpin(); }
+};
+
+// Pin the current epoch until the returned guard goes out of scope. Pins nest.
+static inline
+Guard pin(){
+	Participant* p = _participant();
+	p->pin_depth += 1;
+	if(p->pin_depth == 1){
+		u64 epoch = atomic::load(&_epoch, atomic::Memory_Order::relaxed);
+		/* Must be visible to try_advance() before we read any shared pointer */
+		atomic::store(&p->state, (epoch << 1) | 1, atomic::Memory_Order::seq_cst);
+
+		p->pin_count += 1;
+		if(p->pin_count % collect_interval == 0){
+			collect();
+		}
+	}
+	return Guard{};
+}
+
+// Free `ptr` back to `allocator` once no pinned thread can reach it. Must be
+// called after `ptr` was unlinked from every shared structure.
+static inline
+void retire(void* ptr, isize size, mem::Allocator allocator){
+	Participant* p = _participant();
+	u64 epoch = atomic::load(&_epoch, atomic::Memory_Order::seq_cst);
+	isize i = isize(epoch % limbo_count);
+	if(p->limbo_epoch[i] != epoch){
+		/* The slot holds an older epoch, at least 3 behind */
+		_free_limbo(p, i);
+		p->limbo_epoch[i] = epoch;
+	}
+
+	auto err = p->limbo[i].append(Retired{ptr, size, allocator});
+	if(err != mem::Allocator_Error::none){
+		panic("Out of memory retiring a node");
+	}
+
+	if(p->limbo[i].len() >= limbo_threshold){
+		collect();
+	}
+}
+
+template<typename T>
+static inline
+void retire(T* obj, mem::Allocator allocator){
+	retire((void*)obj, sizeof(T), allocator);
+}
+}
+
+namespace atomic {
+// Pointer with a 16 bit version tag packed in the upper bits, which user space
+// pointers leave unused on x86-64 and AArch64. Bumping the tag on every update
+// makes a CAS fail if the pointer was swapped out and back in between (ABA).
+template<typename T>
+struct Tagged_Ptr {
+	u64 bits = 0;
+
+	static constexpr u64 ptr_mask = (u64(1) << 48) - 1;
+
+	T* ptr() const { return (T*)uintptr(bits & ptr_mask); }
+
+	u16 tag() const { return u16(bits >> 48); }
+
+	// Same slot pointing to `p`, with the next tag
+	Tagged_Ptr with(T* p) const {
+		return from(p, u16(tag() + 1));
+	}
+
+	bool operator==(Tagged_Ptr const& other) const { return bits == other.bits; }
+	bool operator!=(Tagged_Ptr const& other) const { return bits != other.bits; }
+
+	static Tagged_Ptr from(T* p, u16 tag){
+		assert((u64(uintptr(p)) & ~ptr_mask) == 0, "Pointer does not fit in 48 bits");
+		Tagged_Ptr t;
+		t.bits = u64(uintptr(p)) | (u64(tag) << 48);
+		return t;
+	}
+};
+static_assert(sizeof(void*) == 8, "Tagged_Ptr requires 64-bit pointers");
+}
+
+/* ---------------- Lock-free Stack & Queue ---------------- */
+// Treiber stack and Michael-Scott queue, nodes are retired through ebr. The
+// allocator must be thread safe. destroy() must only be called once no other
+// thread uses the container.
+template<typename T>
+struct Lock_Free_Stack {
+	struct Node {
+		T value;
+		Node* next;
+	};
+
+	std::atomic<atomic::Tagged_Ptr<Node>> head;
+	mem::Allocator allocator;
+
+	mem::Allocator_Error push(T const& value){
+		auto res = allocator.try_alloc_non_zero(sizeof(Node), alignof(Node));
+		if(!res.ok()){ return res.unwrap_err(); }
+		auto node = (Node*)res.unwrap();
+		new (&node->value) T(value);
+
+		auto top = atomic::load(&head, atomic::Memory_Order::relaxed);
+		do {
+			node->next = top.ptr();
+		} while(!atomic::compare_exchange_weak(&head, &top, top.with(node), atomic::Memory_Order::release));
+		return mem::Allocator_Error::none;
+	}
+
+	Option<T> pop(){
+		auto guard = ebr::pin();
+		auto top = atomic::load(&head, atomic::Memory_Order::acquire);
+		while(top.ptr() != nullptr){
+			Node* node = top.ptr();
+			if(atomic::compare_exchange_weak(&head, &top, top.with(node->next), atomic::Memory_Order::acquire)){
+				T value = static_cast<T&&>(node->value);
+				node->value.~T();
+				ebr::retire(node, allocator);
+				return value;
+			}
+		}
+		return {};
+	}
+
+	bool empty(){
+		return atomic::load(&head, atomic::Memory_Order::acquire).ptr() == nullptr;
+	}
+
+	static Lock_Free_Stack from(mem::Allocator allocator){
+		return Lock_Free_Stack{ {}, allocator };
+	}
+
+	void destroy(){
+		Node* node = atomic::load(&head, atomic::Memory_Order::acquire).ptr();
+		while(node != nullptr){
+			Node* next = node->next;
+			node->value.~T();
+			allocator.destroy(node);
+			node = next;
+		}
+		atomic::store(&head, atomic::Tagged_Ptr<Node>{}, atomic::Memory_Order::relaxed);
+	}
+};
+
+template<typename T>
+struct Lock_Free_Queue {
+	/* The node at head is a dummy, values live in the nodes after it */
+	struct Node {
+		std::atomic<atomic::Tagged_Ptr<Node>> next;
+		alignas(T) byte storage[sizeof(T)];
+
+		T* value(){ return (T*)storage; }
+	};
+
+	/* Producers and consumers each write only one of these */
+	atomic::Cache_Padded<std::atomic<atomic::Tagged_Ptr<Node>>> head;
+	atomic::Cache_Padded<std::atomic<atomic::Tagged_Ptr<Node>>> tail;
+	mem::Allocator allocator;
+
+	mem::Allocator_Error push(T const& value){
+		if(atomic::load(&tail.value, atomic::Memory_Order::relaxed).ptr() == nullptr){
+			return mem::Allocator_Error::out_of_memory;
+		}
+		auto res = allocator.try_alloc_non_zero(sizeof(Node), alignof(Node));
+		if(!res.ok()){ return res.unwrap_err(); }
+		auto node = (Node*)res.unwrap();
+		new (node->value()) T(value);
+		atomic::store(&node->next, atomic::Tagged_Ptr<Node>{}, atomic::Memory_Order::relaxed);
+
+		auto guard = ebr::pin();
+		for(;;){
+			auto last = atomic::load(&tail.value, atomic::Memory_Order::acquire);
+			auto next = atomic::load(&last.ptr()->next, atomic::Memory_Order::acquire);
+			if(last != atomic::load(&tail.value, atomic::Memory_Order::acquire)){ continue; }
+
+			if(next.ptr() == nullptr){
+				if(atomic::compare_exchange_weak(&last.ptr()->next, &next, next.with(node), atomic::Memory_Order::release)){
+					atomic::compare_exchange_strong(&tail.value, &last, last.with(node), atomic::Memory_Order::release);
+					return mem::Allocator_Error::none;
+				}
+			} else {
+				/* Tail is lagging, help move it forward */
+				atomic::compare_exchange_strong(&tail.value, &last, last.with(next.ptr()), atomic::Memory_Order::release);
+			}
+		}
+	}
+
+	Option<T> pop(){
+		auto guard = ebr::pin();
+		for(;;){
+			auto first = atomic::load(&head.value, atomic::Memory_Order::acquire);
+			if(first.ptr() == nullptr){ return {}; }
+			auto last = atomic::load(&tail.value, atomic::Memory_Order::acquire);
+			auto next = atomic::load(&first.ptr()->next, atomic::Memory_Order::acquire);
+			if(first != atomic::load(&head.value, atomic::Memory_Order::acquire)){ continue; }
+
+			if(first.ptr() == last.ptr()){
+				if(next.ptr() == nullptr){ return {}; }
+				atomic::compare_exchange_strong(&tail.value, &last, last.with(next.ptr()), atomic::Memory_Order::release);
+			} else if(atomic::compare_exchange_weak(&head.value, &first, first.with(next.ptr()), atomic::Memory_Order::acq_rel)){
+				/* `next` is the new dummy, only the winning thread reads its value */
+				T* v = next.ptr()->value();
+				T value = static_cast<T&&>(*v);
+				v->~T();
+				ebr::retire(first.ptr(), allocator);
+				return value;
+			}
+		}
+	}
+
+	bool empty(){
+		auto first = atomic::load(&head.value, atomic::Memory_Order::acquire);
+		if(first.ptr() == nullptr){ return true; }
+		return atomic::load(&first.ptr()->next, atomic::Memory_Order::acquire).ptr() == nullptr;
+	}
+
+	// If the dummy node can't be allocated the queue stays empty and push()
+	// reports out_of_memory
+	static Lock_Free_Queue from(mem::Allocator allocator){
+		auto res = allocator.try_alloc(sizeof(Node), alignof(Node));
+		auto dummy = res.ok() ? (Node*)res.unwrap() : nullptr;
+		auto p = atomic::Tagged_Ptr<Node>::from(dummy, 0);
+		return Lock_Free_Queue{ {{p}}, {{p}}, allocator };
+	}
+
+	void destroy(){
+		Node* node = atomic::load(&head.value, atomic::Memory_Order::acquire).ptr();
+		bool dummy = true;
+		while(node != nullptr){
+			Node* next = atomic::load(&node->next, atomic::Memory_Order::relaxed).ptr();
+			if(!dummy){ node->value()->~T(); }
+			allocator.destroy(node);
+			dummy = false;
+			node = next;
+		}
+		atomic::store(&head.value, atomic::Tagged_Ptr<Node>{}, atomic::Memory_Order::relaxed);
+		atomic::store(&tail.value, atomic::Tagged_Ptr<Node>{}, atomic::Memory_Order::relaxed);
+	}
+};
+
+/* ---------------- Sharded Counter ---------------- */
+namespace atomic {
+inline std::atomic<u32> _next_thread_slot = 0;
+inline thread_local u32 _thread_slot = 0; /* 0 until the thread first touches a sharded counter */
+
+static inline
+u32 _slot(){
+	u32 slot = _thread_slot;
+	[[unlikely]] if(slot == 0){
+		slot = atomic::fetch_add(&_next_thread_slot, u32(1), Memory_Order::relaxed) + 1;
+		_thread_slot = slot;
+	}
+	return slot - 1;
+}
+
+// Counter spread over `Shards` cache lines. Threads are assigned shards round
+// robin on first use and add to their own with a relaxed, uncontended atomic,
+// reads sum all shards. Meant for hot statistics counters, where a single
+// shared atomic makes every increment bounce its cache line between cores.
+template<isize Shards = 16>
+struct Sharded_Counter {
+	static_assert(Shards > 0 && (Shards & (Shards - 1)) == 0, "Shard count must be a power of 2");
+
+	Cache_Padded<std::atomic<i64>> shards[Shards] = {};
+
+	void add(i64 delta){
+		atomic::fetch_add(&shards[_slot() & (Shards - 1)].value, delta, Memory_Order::relaxed);
+	}
+
+	void increment(){ add(1); }
+
+	void decrement(){ add(-1); }
+
+	// Sum of all shards. Concurrent adds may or may not be included.
+	i64 load(){
+		i64 total = 0;
+		for(isize i = 0; i < Shards; i++){
+			total += atomic::load(&shards[i].value, Memory_Order::relaxed);
+		}
+		return total;
+	}
+
+	// Zero every shard. Adds racing with a reset may be lost.
+	void reset(){
+		for(isize i = 0; i < Shards; i++){
+			atomic::store(&shards[i].value, i64(0), Memory_Order::relaxed);
+		}
+	}
+};
+}
+
+/* ---------------- Seqlock ---------------- */
+namespace atomic {
+// Sequence lock for small, read-mostly values. Readers never write shared
+// memory: they copy the value and retry if a writer ran meanwhile, which the
+// sequence number tells (odd while a write is in progress). Writers serialize
+// among themselves on the same sequence number. The value is copied word by
+// word with relaxed atomics, so torn reads are well defined and discarded.
+template<typename T>
+struct Seqlock {
+	static_assert(std::is_trivially_copyable_v<T>, "Seqlock value must be trivially copyable");
+	static constexpr isize word_count = (isize(sizeof(T)) + 7) / 8;
+
+	std::atomic<u64> sequence = 0;
+	std::atomic<u64> words[word_count] = {};
+
+	void store(T const& value){
+		u64 seq = atomic::load(&sequence, Memory_Order::relaxed);
+		for(;;){
+			if((seq & 1) == 0 && atomic::compare_exchange_weak(&sequence, &seq, seq + 1, Memory_Order::acquire)){
+				break;
+			}
+			seq = atomic::load(&sequence, Memory_Order::relaxed);
+		}
+		/* Readers must not see new words without also seeing the odd sequence */
+		atomic::thread_fence(Memory_Order::release);
+
+		u64 buf[word_count] = {};
+		mem::copy_no_overlap(buf, &value, sizeof(T));
+		for(isize i = 0; i < word_count; i++){
+			atomic::store(&words[i], buf[i], Memory_Order::relaxed);
+		}
+		atomic::store(&sequence, seq + 2, Memory_Order::release);
+	}
+
+	// Single attempt, fails if a write was in progress or happened during the copy
+	Option<T> try_load(){
+		u64 before = atomic::load(&sequence, Memory_Order::acquire);
+		if(before & 1){ return {}; }
+
+		u64 buf[word_count];
+		for(isize i = 0; i < word_count; i++){
+			buf[i] = atomic::load(&words[i], Memory_Order::relaxed);
+		}
+		atomic::thread_fence(Memory_Order::acquire);
+		if(atomic::load(&sequence, Memory_Order::relaxed) != before){ return {}; }
+
+		T value;
+		mem::copy_no_overlap(&value, buf, sizeof(T));
+		return value;
+	}
+
+	T load(){
+		for(;;){
+			auto value = try_load();
+			if(value.ok()){ return value.unwrap_unchecked(); }
+		}
+	}
+};
+}